@@ -0,0 +1,58 @@
+#!/usr/bin/env python
+
+# Copyright Bohan Cao (2110313@mail.nankai.edu.cn) 2023
+# Strong scaling of ModelDecomposition: run a binary whose main calls
+# test_decomposition() with every number of ranks, and tabulate the throughput of
+# slabs against one rank. The curve is plotted into scaling.png if matplotlib exists.
+# Usage: python scaling.py ./test_decomposition [ranks ...] [-- mpirun options]
+
+import re
+import subprocess
+import sys
+
+PATTERN = re.compile(r'(\d+) ranks, (\d+) nodes .*slabs=([0-9.e+-]+) nodes/s')
+
+
+def run(binary, ranks, options):
+    output = subprocess.run(['mpirun', '-np', str(ranks)] + options + [binary],
+                            check=True, capture_output=True, text=True).stdout
+    match = PATTERN.search(output)
+    if match is None:
+        raise RuntimeError('no result of %i ranks:\n%s' % (ranks, output))
+    return int(match.group(2)), float(match.group(3))
+
+
+def main():
+    if len(sys.argv) < 2:
+        print('Usage: python scaling.py binary [ranks ...] [-- mpirun options]')
+        sys.exit(1)
+    args = sys.argv[2:]
+    options = []
+    if '--' in args:
+        options = args[args.index('--')+1:]
+        args = args[:args.index('--')]
+    ranks = [int(i) for i in args] or [1, 2, 4, 8]
+
+    results = [run(sys.argv[1], k, options) for k in ranks]
+    base = results[0][1] / ranks[0]
+    print('# %i nodes\n# ranks\tnodes/s\tspeedup\tefficiency' % results[0][0])
+    for k, (_, throughput) in zip(ranks, results):
+        print('%i\t%.3e\t%.2f\t%.2f' % (k, throughput, throughput / base,
+                                        throughput / base / k))
+
+    try:
+        import matplotlib
+        matplotlib.use('Agg')
+        import matplotlib.pyplot as plt
+    except ImportError:
+        return
+    plt.plot(ranks, [i[1] / base for i in results], 'o-', label='slabs')
+    plt.plot(ranks, ranks, '--', label='ideal')
+    plt.xlabel('ranks')
+    plt.ylabel('speedup')
+    plt.legend()
+    plt.savefig('scaling.png')
+
+
+if __name__ == '__main__':
+    main()
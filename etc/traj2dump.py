@@ -0,0 +1,133 @@
+#!/usr/bin/env python
+
+# Copyright Bohan Cao (2110313@mail.nankai.edu.cn) 2023
+# Convert binary trajectory (.traj) into LAMMPS data (.data) and dump (.dump) text
+# files, the same as those written by ModelSystem::dump, so ovito preset still works.
+# Usage: python traj2dump.py test.traj [first_frame [last_frame]]
+
+import mmap
+import struct
+import sys
+
+HEADER = struct.Struct('<8sIIQQQII6dd128s')
+TRAILER = struct.Struct('<QQ8s')
+HAS_VELOCITIES = 1
+FRAME_MAGIC = b'QTUBEFRM'
+
+DATA_HEADER = ('# Model for quadratube. AUTO generated, DO NOT EDIT\n\n'
+               '%i\tatoms\n%i\tbonds\n\n%i\tatom types\n%i\tbond types\n\n'
+               '%.8f\t%.8f\txlo xhi\n%.8f\t%.8f\tylo yhi\n%.8f\t%.8f\tzlo zhi\n\n'
+               'Masses\n\n1\t%.8f\n')
+DUMP_HEADER = ('ITEM: TIMESTEP\n%i\nITEM: NUMBER OF ATOMS\n%i\nITEM: BOX BOUNDS ss ss ss\n'
+               '%.8f\t%.8f\n%.8f\t%.8f\n%.8f\t%.8f\nITEM: ATOMS id type x y z')
+
+
+class Trajectory:
+    """Memory mapped trajectory, frames are located by the trailing index, or by
+    scanning if an append was interrupted."""
+
+    def __init__(self, file_name):
+        with open(file_name, 'rb') as f:
+            self.buffer = mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ)
+        (magic, version, self.flags, self.atoms, self.bonds1, self.bonds2,
+         self.columns, _, *boundary, self.mass, names) = HEADER.unpack_from(self.buffer, 0)
+        if magic != b'QTUBETRJ' or version != 2:
+            raise ValueError('%s is not a trajectory' % file_name)
+        self.boundary = boundary
+        self.column_names = [names[16*i:16*i+16].split(b'\0')[0].decode()
+                             for i in range(self.columns)]
+
+        offset = HEADER.size
+        self.types = self.array('i', self.atoms, offset)
+        offset += 4*self.atoms
+        self.bonds = [self.array('i', 2*self.bonds1, offset)]
+        offset += 8*self.bonds1
+        self.bonds.append(self.array('i', 2*self.bonds2, offset))
+        offset += 8*self.bonds2
+
+        # frames are back to back, each ends with its magic
+        first = (offset + 7) // 8 * 8
+        vectors = 2 if self.flags & HAS_VELOCITIES else 1
+        width = 8 + 8*(3*vectors + self.columns)*self.atoms + 8
+        length = len(self.buffer)
+        index_offset, frames, magic = TRAILER.unpack_from(self.buffer, length - TRAILER.size)
+        if (magic == b'QTUBEIDX' and index_offset == first + frames*width and
+                index_offset + 8*frames + TRAILER.size == length):
+            self.index = self.array('Q', frames, index_offset)
+            if all(self.index[k] == first + k*width for k in range(frames)):
+                return
+        self.index = []
+        while (first + (len(self.index)+1)*width <= length and
+               self.buffer[first + (len(self.index)+1)*width - 8:
+                           first + (len(self.index)+1)*width] == FRAME_MAGIC):
+            self.index.append(first + len(self.index)*width)
+        sys.stderr.write('index of %s is broken, %i frames recovered\n' %
+                         (file_name, len(self.index)))
+
+    def array(self, tp, n, offset):
+        """n little-endian numbers of struct type tp"""
+        return struct.unpack_from('<%i%s' % (n, tp), self.buffer, offset)
+
+    def __len__(self):
+        return len(self.index)
+
+    def frame(self, k):
+        """time step, positions, velocities (or None), columns of frame k"""
+        offset = int(self.index[k])
+        time_step = struct.unpack_from('<q', self.buffer, offset)[0]
+        offset += 8
+        positions = self.array('d', 3*self.atoms, offset)
+        offset += 24*self.atoms
+        velocities = None
+        if self.flags & HAS_VELOCITIES:
+            velocities = self.array('d', 3*self.atoms, offset)
+            offset += 24*self.atoms
+        columns = self.array('d', self.columns*self.atoms, offset)
+        return time_step, positions, velocities, columns
+
+
+def write_data(traj, file_name, positions):
+    atom_types = max(traj.types, default=1)
+    bond_types = 2 if traj.bonds2 else 1
+    with open(file_name, 'w') as f:
+        f.write(DATA_HEADER % (traj.atoms, traj.bonds1 + traj.bonds2, atom_types,
+                               bond_types, *traj.boundary, traj.mass))
+        if atom_types == 2:
+            f.write('2\t%.8f\n' % traj.mass)
+        f.write('\nAtoms\n\n')
+        for i in range(traj.atoms):
+            f.write('%i\t%i\t%.8f\t%.8f\t%.8f\n' % (i, traj.types[i], *positions[3*i:3*i+3]))
+        f.write('\nBonds\n\n')
+        i = 0
+        for tp, bonds in enumerate(traj.bonds):
+            for j in range(0, len(bonds), 2):
+                f.write('%i\t%i\t%i\t%i\n' % (i, tp + 1, bonds[j], bonds[j+1]))
+                i += 1
+
+
+def write_dump(traj, file_name, first, last):
+    with open(file_name, 'w') as f:
+        for k in range(first, last):
+            time_step, positions, velocities, columns = traj.frame(k)
+            f.write(DUMP_HEADER % (time_step, traj.atoms, *traj.boundary))
+            if velocities is not None:
+                f.write(' vx vy vz')
+            for name in traj.column_names:
+                f.write(' %s' % name)
+            f.write('\n')
+            for i in range(traj.atoms):
+                f.write('%i\t%i\t%.8f\t%.8f\t%.8f' % (i, traj.types[i], *positions[3*i:3*i+3]))
+                if velocities is not None:
+                    f.write('\t%.8f\t%.8f\t%.8f' % velocities[3*i:3*i+3])
+                for j in range(traj.columns):
+                    f.write('\t%.8f' % columns[j*traj.atoms + i])
+                f.write('\n')
+
+
+if __name__ == '__main__':
+    traj = Trajectory(sys.argv[1])
+    first = int(sys.argv[2]) if len(sys.argv) > 2 else 0
+    last = int(sys.argv[3]) if len(sys.argv) > 3 else len(traj)
+    base = sys.argv[1][:-5] if sys.argv[1].endswith('.traj') else sys.argv[1]
+    write_data(traj, base + '.data', traj.frame(first)[1])
+    write_dump(traj, base + '.dump', first, last)
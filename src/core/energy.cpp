@@ -9,22 +9,25 @@
  */
 #include "core/energy.h"
 
-#include "core/math.h"
 #include <stdio.h>
+
+#include "core/math.h"
+
 namespace CoreEnergy {
 
+template <typename T>
 KOKKOS_FUNCTION
-double mean_curvature(const CoreMath::Array<CoreMath::Vector>& others) {
-  CoreMath::Vector H_vec;
-  double size = 0;
+T mean_curvature(const CoreMath::Array<CoreMath::BasicVector<T>>& others) {
+  CoreMath::BasicVector<T> H_vec;
+  T size = 0;
 
   for (int i = 0; i < others.size(); i++) {
     int left = (i==0) ? others.size()-1 : i-1;
     int right = (i==others.size()-1) ? 0 : i+1;
 
     // vectors for a node and its related bonds
-    CoreMath::Vector left_up = others[left] - others[i];
-    CoreMath::Vector right_up = others[right] - others[i];
+    CoreMath::BasicVector<T> left_up = others[left] - others[i];
+    CoreMath::BasicVector<T> right_up = others[right] - others[i];
 
     // tan(acos(x)) = sqrt(1/x/x-1), if x = a*b/|a||b|, tan(acos(x)) = a*b/|a\times b|
     H_vec += (left_up*others[left]/CoreMath::mod(CoreMath::cross(left_up, others[left])) + 
@@ -35,10 +38,11 @@ double mean_curvature(const CoreMath::Array<CoreMath::Vector>& others) {
   return CoreMath::mod(H_vec)*3/4/size;
 }
 
+template <typename T>
 KOKKOS_FUNCTION
-double gaussian_curvature(const CoreMath::Array<CoreMath::Vector>& others) {
+T gaussian_curvature(const CoreMath::Array<CoreMath::BasicVector<T>>& others) {
   // Size around this node, total angle
-  double angles = 2*PI, size = 0;
+  T angles = 2*PI, size = 0;
   for (int i=0; i<others.size(); i++) {
     int right = (i==others.size()-1) ? 0 : i+1;
 
@@ -50,21 +54,31 @@ double gaussian_curvature(const CoreMath::Array<CoreMath::Vector>& others) {
   return angles*3/size;
 }
 
-KOKKOS_FUNCTION
-double curvature_energy(const double* para, const CoreMath::Array<CoreMath::Vector>& others) {
-  // when you don't want to have curvature, just set para[0] = 0
-  if (para[0] == 0)
-    return 0;
-  CoreMath::Vector H_vec;
-  double size = 0, angles = 2*PI;
+namespace {
 
-  for (int i = 0; i < others.size(); i++) {
-    int left = (i==0) ? others.size()-1 : i-1;
-    int right = (i==others.size()-1) ? 0 : i+1;
+/// @brief left and right neighbour of i on a ring of n
+KOKKOS_FORCEINLINE_FUNCTION
+constexpr int ring_left(int i, int n) { return (i==0) ? n-1 : i-1; }
+KOKKOS_FORCEINLINE_FUNCTION
+constexpr int ring_right(int i, int n) { return (i==n-1) ? 0 : i+1; }
+
+/// @brief curvature energy of nodes with N adjacents, or any number if N = 0. With
+///     N known at compile time, loops have constant trip counts and are unrolled by
+///     the compiler, ring indices are folded into constants.
+template <int N, typename T>
+KOKKOS_INLINE_FUNCTION
+T ring_curvature_energy(const double* para,
+    const CoreMath::Array<CoreMath::BasicVector<T>>& others) {
+  const int n = (N > 0) ? N : others.size();
+  CoreMath::BasicVector<T> H_vec;
+  T size = 0, angles = 2*PI;
+
+  for (int i=0; i<n; i++) {
+    int left = ring_left(i, n), right = ring_right(i, n);
 
     // vectors for a node and its related bonds
-    CoreMath::Vector left_up = others[left] - others[i];
-    CoreMath::Vector right_up = others[right] - others[i];
+    CoreMath::BasicVector<T> left_up = others[left] - others[i];
+    CoreMath::BasicVector<T> right_up = others[right] - others[i];
 
     // tan(acos(x)) = sqrt(1/x/x-1), if x = a*b/|a||b|, tan(acos(x)) = a*b/|a\times b|
     H_vec += (left_up*others[left]/CoreMath::mod(CoreMath::cross(left_up, others[left])) + 
@@ -74,31 +88,33 @@ double curvature_energy(const double* para, const CoreMath::Array<CoreMath::Vect
         CoreMath::mod(others[i]));
   }
 
-  return para[0]*((H_vec*H_vec)*9/8/size/size - angles*3/size);
+  return T(para[0])*((H_vec*H_vec)*9/8/size/size - angles*3/size);
 }
 
-KOKKOS_FUNCTION
-CoreMath::Array<CoreMath::Vector> curvature_gradient(const double* para, 
-    const CoreMath::Array<CoreMath::Vector>& others) {
-  if (para[0] == 0)
-    return CoreMath::Array<CoreMath::Vector>(others.size());
+/// @brief curvature gradient of nodes with N adjacents, or any number if N = 0.
+///     Scratch are plain arrays of the largest degree.
+template <int N, typename T>
+KOKKOS_INLINE_FUNCTION
+CoreMath::Array<CoreMath::BasicVector<T>> ring_curvature_gradient(const double* para, 
+    const CoreMath::Array<CoreMath::BasicVector<T>>& others) {
+  const int n = (N > 0) ? N : others.size();
+  constexpr int capacity = (N > 0) ? N : 8;
   // angle, size*2
-  double angles = 2*PI, size2 = 0;
-  CoreMath::Vector H_vec;
+  T angles = 2*PI, size2 = 0;
+  CoreMath::BasicVector<T> H_vec;
 
-  CoreMath::Array<CoreMath::Vector> result(others.size());
+  CoreMath::Array<CoreMath::BasicVector<T>> result(n);
 
   // compute a*b, |a\times b|, (|a||b|)^2, (c-a)*c, |(c-a)\times c|, |c-a||c|, 
   // (b-a)*b, |(b-a)\times b|, |b-a||b|
-  auto s = others.size();
-  CoreMath::Array<double> a0(s), a1(s), a2(s), b0(s), b1(s), b2(s), c0(s), c1(s), c2(s);
-  for (int i=0; i<others.size(); i++) {
-    int il = (i==0) ? others.size()-1 : i-1;
-    int ir = (i==others.size()-1) ? 0 : i+1;
+  T a0[capacity], a1[capacity], a2[capacity], b0[capacity], b1[capacity], b2[capacity],
+      c0[capacity], c1[capacity], c2[capacity];
+  for (int i=0; i<n; i++) {
+    int il = ring_left(i, n), ir = ring_right(i, n);
 
     // vectors for a node and its related bonds
-    CoreMath::Vector il_i = others[il] - others[i];
-    CoreMath::Vector ir_i = others[ir] - others[i];
+    CoreMath::BasicVector<T> il_i = others[il] - others[i];
+    CoreMath::BasicVector<T> ir_i = others[ir] - others[i];
 
     a0[i] = others[i]*others[ir];
     a1[i] = CoreMath::mod(CoreMath::cross(others[i], others[ir]));
@@ -116,25 +132,24 @@ CoreMath::Array<CoreMath::Vector> curvature_gradient(const double* para,
   }
 
   // Gaussian curvature and mean curvature
-  double G = 6*angles/size2, H = CoreMath::mod(H_vec)*3/2/size2;
-  double G_4H2 = G - 4*H*H;
+  T G = 6*angles/size2, H = CoreMath::mod(H_vec)*3/2/size2;
+  T G_4H2 = G - 4*H*H;
   H_vec = H_vec / CoreMath::mod(H_vec);
 
   // compute gradient
-  for (int i=0; i<others.size(); i++) {
-    int il = (i==0) ? others.size()-1 : i-1;
-    int ir = (i==others.size()-1) ? 0 : i+1;
+  for (int i=0; i<n; i++) {
+    int il = ring_left(i, n), ir = ring_right(i, n);
 
     // vectors for a node and its related bonds
-    CoreMath::Vector il_i = others[il] - others[i];
-    CoreMath::Vector ir_i = others[ir] - others[i];
+    CoreMath::BasicVector<T> il_i = others[il] - others[i];
+    CoreMath::BasicVector<T> ir_i = others[ir] - others[i];
 
-    double k = para[0]/a1[i]/size2;
-    double k1 = 6 + G_4H2*a0[i];
-    double k2 = 6*a0[i]/a2[i]/a2[i] + G_4H2;
-    double k3 = 6*para[0]*H/size2;
-    double k4 = b2[i]*b2[i]/b1[i]/b1[i]/b1[i]*(others[i]*H_vec);
-    double k5 = c2[i]*c2[i]/c1[i]/c1[i]/c1[i]*(others[i]*H_vec);
+    T k = T(para[0])/a1[i]/size2;
+    T k1 = 6 + G_4H2*a0[i];
+    T k2 = 6*a0[i]/a2[i]/a2[i] + G_4H2;
+    T k3 = 6*T(para[0])*H/size2;
+    T k4 = b2[i]*b2[i]/b1[i]/b1[i]/b1[i]*(others[i]*H_vec);
+    T k5 = c2[i]*c2[i]/c1[i]/c1[i]/c1[i]*(others[i]*H_vec);
 
     result[i] += k*(k2*(others[ir]*others[ir])*others[i] - k1*others[ir]) +
         k3*((b0[i]/b1[i] + c0[i]/c1[i]) * H_vec -
@@ -150,4 +165,55 @@ CoreMath::Array<CoreMath::Vector> curvature_gradient(const double* para,
   return result;
 }
 
+} // namespace
+
+template <typename T>
+KOKKOS_FUNCTION
+T curvature_energy(const double* para,
+    const CoreMath::Array<CoreMath::BasicVector<T>>& others) {
+  // when you don't want to have curvature, just set para[0] = 0
+  if (para[0] == 0)
+    return 0;
+  // fixed degrees of nodes in triangular and quadrangular grids (and defects)
+  switch (others.size()) {
+    case 4: return ring_curvature_energy<4>(para, others);
+    case 5: return ring_curvature_energy<5>(para, others);
+    case 6: return ring_curvature_energy<6>(para, others);
+    case 7: return ring_curvature_energy<7>(para, others);
+    default: return ring_curvature_energy<0>(para, others);
+  }
+}
+
+template <typename T>
+KOKKOS_FUNCTION
+CoreMath::Array<CoreMath::BasicVector<T>> curvature_gradient(const double* para, 
+    const CoreMath::Array<CoreMath::BasicVector<T>>& others) {
+  if (para[0] == 0)
+    return CoreMath::Array<CoreMath::BasicVector<T>>(others.size());
+  switch (others.size()) {
+    case 4: return ring_curvature_gradient<4>(para, others);
+    case 5: return ring_curvature_gradient<5>(para, others);
+    case 6: return ring_curvature_gradient<6>(para, others);
+    case 7: return ring_curvature_gradient<7>(para, others);
+    default: return ring_curvature_gradient<0>(para, others);
+  }
+}
+
+// instances of double, and float for mixed precision
+#define QUADRATUBE_ENERGY_INSTANCE(T) \
+  template KOKKOS_FUNCTION T mean_curvature<T>(const CoreMath::Array<CoreMath::BasicVector<T>>&); \
+  template KOKKOS_FUNCTION T gaussian_curvature<T>( \
+      const CoreMath::Array<CoreMath::BasicVector<T>>&); \
+  template KOKKOS_FUNCTION T curvature_energy<T>(const double*, \
+      const CoreMath::Array<CoreMath::BasicVector<T>>&); \
+  template KOKKOS_FUNCTION CoreMath::Array<CoreMath::BasicVector<T>> curvature_gradient<T>( \
+      const double*, const CoreMath::Array<CoreMath::BasicVector<T>>&);
+QUADRATUBE_ENERGY_INSTANCE(double)
+QUADRATUBE_ENERGY_INSTANCE(float)
+#undef QUADRATUBE_ENERGY_INSTANCE
+// lanes of nodes with the same degree, for kCurvatureBatch of ModelSystem
+template KOKKOS_FUNCTION CoreMath::Array<CoreMath::BasicVector<CoreMath::RealSimd>>
+curvature_gradient<CoreMath::RealSimd>(const double*,
+    const CoreMath::Array<CoreMath::BasicVector<CoreMath::RealSimd>>&);
+
 } // namespace CoreEnergy
\ No newline at end of file
@@ -16,20 +16,163 @@
 
 namespace CoreEnergy {
 
+/// @brief Energy and gradient functions are templates of scalar T (double, or float
+///     in mixed precision), parameters are double and converted to T.
+
+/**
+ * @brief Pair potentials of bonds
+ * @details A pair potential is a struct of static functions of r^2, energy and
+ *     derivative dE/d(r^2), so that the gradient with respect to other is
+ *     2 dE/d(r^2) other, and range of r^2 tabulated by PairTable. Define a struct
+ *     like these and use it as a bond potential of Metadata::EnergyMetaData.
+ */
+
+/// @brief harmonic bond, para[0]: rest length, para[1]: elastic coefficient k
+struct Harmonic {
+  template <typename T>
+  KOKKOS_INLINE_FUNCTION
+  static T energy(const double* para, T r2) {
+    T stretch = Kokkos::sqrt(r2) - T(para[0]);
+    return T(para[1])/2 * stretch * stretch;
+  }
+  template <typename T>
+  KOKKOS_INLINE_FUNCTION
+  static T derivative(const double* para, T r2) {
+    return T(para[1])/2 * (1 - T(para[0])/Kokkos::sqrt(r2));
+  }
+  static void range(const double* para, double& r2_min, double& r2_max) {
+    r2_min = para[0]*para[0] / 4;
+    r2_max = para[0]*para[0] * 4;
+  }
+};
+
+/// @brief Lennard-Jones truncated & shifted potential, para[0]: rest length,
+///     para[1]: coefficient, para[2]: cutoff length. With s = (r_min / r)^6,
+///     E = k s (s - 2) - shift, without pow or sqrt.
+struct Ljts {
+  template <typename T>
+  KOKKOS_INLINE_FUNCTION
+  static T energy(const double* para, T r2) {
+    if (r2 > T(para[2]*para[2]))
+      return 0;
+    // (r_min / r_end)^6
+    T rmin_rend2 = T(para[0]*para[0] / (para[2]*para[2]));
+    T rmin_rend6 = rmin_rend2 * rmin_rend2 * rmin_rend2;
+    T cutoff_energy = (rmin_rend6 - 2) * rmin_rend6;
+    // (r_min / r)^6
+    T rmin_r2 = T(para[0]*para[0]) / r2;
+    T rmin_r6 = rmin_r2 * rmin_r2 * rmin_r2;
+    return T(para[1]) * (rmin_r6 - 2) * rmin_r6 - cutoff_energy;
+  }
+  template <typename T>
+  KOKKOS_INLINE_FUNCTION
+  static T derivative(const double* para, T r2) {
+    if (r2 > T(para[2]*para[2]))
+      return 0;
+    T rmin_r2 = T(para[0]*para[0]) / r2;
+    T rmin_r6 = rmin_r2 * rmin_r2 * rmin_r2;
+    return 6 * T(para[1]) * rmin_r6 * (1 - rmin_r6) / r2;
+  }
+  /// @brief from 0.8 r_min, closer bonds are rare and steep, evaluated analytically
+  static void range(const double* para, double& r2_min, double& r2_max) {
+    r2_min = 0.64 * para[0]*para[0];
+    r2_max = para[2]*para[2];
+  }
+};
+
+/**
+ * @class PairTable
+ * @brief Cubic Hermite spline of a pair potential over r^2
+ * @details Values and derivatives of the analytic potential are matched at every
+ *     grid point of uniform intervals in [r2_min, r2_max], so energies and
+ *     gradients come from the same piecewise cubic. Outside the range (or if not
+ *     built), contains() is false and the analytic potential should be used.
+ */
+class PairTable {
+  public:
+    /// @brief tabulate Potential with its parameters and range, on host
+    template <typename Potential>
+    void build(const double* para, int intervals) {
+      double r2_min, r2_max;
+      Potential::range(para, r2_min, r2_max);
+      double width = (r2_max - r2_min) / intervals;
+      Kokkos::View<double*[4]> coefficients("pair_table", intervals);
+      auto host = Kokkos::create_mirror_view(coefficients);
+      // the last grid point is r2_max exactly, not beyond a cutoff by rounding
+      auto grid = [&](int k) { return (k == intervals) ? r2_max : r2_min + k*width; };
+      for (int k=0; k<intervals; k++) {
+        double e0 = Potential::energy(para, grid(k)), e1 = Potential::energy(para, grid(k+1));
+        double m0 = Potential::derivative(para, grid(k)) * width;
+        double m1 = Potential::derivative(para, grid(k+1)) * width;
+        host(k, 0) = e0;
+        host(k, 1) = m0;
+        host(k, 2) = 3*(e1 - e0) - 2*m0 - m1;
+        host(k, 3) = 2*(e0 - e1) + m0 + m1;
+      }
+      Kokkos::deep_copy(coefficients, host);
+      __coefficients = coefficients;
+      __r2_min = r2_min;
+      __r2_max = r2_max;
+      __inverse_width = 1 / width;
+    }
+    /// @brief number of intervals, 0 if not built
+    inline int size() const { return __coefficients.extent(0); }
+
+    template <typename T>
+    KOKKOS_INLINE_FUNCTION
+    bool contains(T r2) const {
+      return __coefficients.extent(0) != 0 && r2 >= __r2_min && r2 < __r2_max;
+    }
+    /// @brief energy and dE/d(r^2), only for r2 inside
+    template <typename T>
+    KOKKOS_INLINE_FUNCTION
+    T energy(T r2) const {
+      int k;
+      T t = __locate(r2, k);
+      return T(__coefficients(k, 0)) + t*(T(__coefficients(k, 1)) +
+          t*(T(__coefficients(k, 2)) + t*T(__coefficients(k, 3))));
+    }
+    template <typename T>
+    KOKKOS_INLINE_FUNCTION
+    T derivative(T r2) const {
+      int k;
+      T t = __locate(r2, k);
+      return (T(__coefficients(k, 1)) + t*(2*T(__coefficients(k, 2)) +
+          t*3*T(__coefficients(k, 3)))) * T(__inverse_width);
+    }
+
+  private:
+    /// @brief interval k of r2, and position in it from 0 to 1
+    template <typename T>
+    KOKKOS_INLINE_FUNCTION
+    T __locate(T r2, int& k) const {
+      double x = (r2 - __r2_min) * __inverse_width;
+      k = Kokkos::min(int(x), int(__coefficients.extent(0)) - 1);
+      return T(x - k);
+    }
+
+    /// @brief a, b, c, d of a + b t + c t^2 + d t^3 for every interval
+    Kokkos::View<double*[4]> __coefficients;
+    double __r2_min = 0, __r2_max = 0, __inverse_width = 0;
+};
+
 /**
  * @brief harmonic bond energy
  * 
  * @param para para[0]: rest length, para[1]: elastic coefficient k
  * @param other 
- * @return double 
+ * @return T 
  */
+template <typename T>
 KOKKOS_INLINE_FUNCTION
-double harmonic_energy(const double* para, const CoreMath::Vector& other) {
-  return para[1]/2 * (CoreMath::mod(other)-para[0]) * (CoreMath::mod(other)-para[0]);
+T harmonic_energy(const double* para, const CoreMath::BasicVector<T>& other) {
+  return Harmonic::energy(para, other*other);
 }
+template <typename T>
 KOKKOS_INLINE_FUNCTION
-CoreMath::Vector harmonic_gradient(const double* para, const CoreMath::Vector& other) {
-  return para[1] * (1-para[0]/CoreMath::mod(other)) * other;
+CoreMath::BasicVector<T> harmonic_gradient(const double* para,
+    const CoreMath::BasicVector<T>& other) {
+  return 2*Harmonic::derivative(para, other*other) * other;
 }
 
 /**
@@ -37,51 +180,51 @@ CoreMath::Vector harmonic_gradient(const double* para, const CoreMath::Vector& o
  * 
  * @param para para[0]: rest length, para[1]: coefficient, para[2]: cutoff length
  * @param other 
- * @return double 
+ * @return T 
  */
+template <typename T>
 KOKKOS_INLINE_FUNCTION
-double ljts_energy(const double* para, const CoreMath::Vector& other) {
-  if (CoreMath::mod(other) > para[2])
-    return 0;
-  // (r_min / r_end)^6
-  double rmin_rend6 = Kokkos::pow(para[0]/para[2], 6);
-  double cutoff_energy = (rmin_rend6 - 2) * rmin_rend6;
-  // (r_min / r)^6
-  double rmin_r6 = Kokkos::pow(para[0]/CoreMath::mod(other), 6);
-  return para[1] * (rmin_r6 - 2) * rmin_r6 - cutoff_energy;
+T ljts_energy(const double* para, const CoreMath::BasicVector<T>& other) {
+  return Ljts::energy(para, other*other);
 }
+template <typename T>
 KOKKOS_INLINE_FUNCTION
-CoreMath::Vector ljts_gradient(const double* para, const CoreMath::Vector& other) {
-  if (CoreMath::mod(other) > para[2])
-    return CoreMath::Vector();
-  // r_min^6 / r^7
-  double rmin6_r7 = Kokkos::pow(para[0], 6) / Kokkos::pow(CoreMath::mod(other), 7);
-  return 12 * para[1] * rmin6_r7*(1/CoreMath::mod(other) - rmin6_r7) * other;
+CoreMath::BasicVector<T> ljts_gradient(const double* para,
+    const CoreMath::BasicVector<T>& other) {
+  return 2*Ljts::derivative(para, other*other) * other;
 }
 
 /**
  * @brief mean curvature and gaussian curvature
+ * @details Defined in energy.cpp for double and float.
  * 
  * @param others 
- * @return double 
+ * @return T 
  */
+template <typename T>
 KOKKOS_FUNCTION
-double mean_curvature(const CoreMath::Array<CoreMath::Vector>& others);
+T mean_curvature(const CoreMath::Array<CoreMath::BasicVector<T>>& others);
+template <typename T>
 KOKKOS_FUNCTION
-double gaussian_curvature(const CoreMath::Array<CoreMath::Vector>& others);
+T gaussian_curvature(const CoreMath::Array<CoreMath::BasicVector<T>>& others);
 
 /**
  * @brief total energy arised from curvature
+ * @details curvature_gradient is also defined for CoreMath::RealSimd, where every
+ *     lane is a node and all of them have others.size() adjacents.
  * 
  * @param para para[0]: coefficient
  * @param others 
- * @return double 
+ * @return T 
  */
+template <typename T>
 KOKKOS_FUNCTION
-double curvature_energy(const double* para, const CoreMath::Array<CoreMath::Vector>& others);
+T curvature_energy(const double* para,
+    const CoreMath::Array<CoreMath::BasicVector<T>>& others);
+template <typename T>
 KOKKOS_FUNCTION
-CoreMath::Array<CoreMath::Vector> curvature_gradient(const double* para, 
-    const CoreMath::Array<CoreMath::Vector>& others);
+CoreMath::Array<CoreMath::BasicVector<T>> curvature_gradient(const double* para, 
+    const CoreMath::Array<CoreMath::BasicVector<T>>& others);
 
 } // namespace CoreEnergy
 
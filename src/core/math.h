@@ -10,10 +10,14 @@
 #ifndef QUADRATUBE_CORE_MATH_H_
 #define QUADRATUBE_CORE_MATH_H_
 
+#include <cstdint>
+
+#include <chrono>
 #include <string>
+#include <type_traits>
 
 #include <Kokkos_DualView.hpp>
-#include <Kokkos_Random.hpp>
+#include <Kokkos_SIMD.hpp>
 
 #define PI 3.141592653589793
 //! Boltzmann constant
@@ -25,8 +29,9 @@ namespace CoreMath {
  * @class Array
  * @brief Array type of capacity N
  * @details All members satisfy definition of vector in C++ standard library,
- *     except 'find()'. Be careful because we never check bounds of array due to 
- *     performance.
+ *     except 'find()'. Bounds are only checked by KOKKOS_ASSERT, that is in debug
+ *     builds of Kokkos, due to performance. Lists built on host are checked
+ *     against capacity() by their builders (ModelInitializer, Csr::build).
  * 
  * @tparam T 
  */
@@ -35,7 +40,7 @@ class Array {
   public:
     /// @brief Constructor
     KOKKOS_INLINE_FUNCTION
-    Array(size_t n = 0): __len(n), __data{T()} {}
+    Array(size_t n = 0): __len(n), __data{T()} { KOKKOS_ASSERT(n <= N); }
 
     /// @brief Iterator
     using iterator = T*;
@@ -49,6 +54,8 @@ class Array {
     size_t size() const { return __len; }
     KOKKOS_INLINE_FUNCTION 
     void resize(size_t n) { __len = n; }
+    KOKKOS_INLINE_FUNCTION
+    static constexpr size_t capacity() { return N; }
 
     /// @brief Element access
     KOKKOS_INLINE_FUNCTION
@@ -60,12 +67,13 @@ class Array {
     
     /// @brief Modifiers
     KOKKOS_INLINE_FUNCTION
-    void push_back(T in) { __data[__len++] = in;}
+    void push_back(T in) { KOKKOS_ASSERT(__len < N); __data[__len++] = in;}
     KOKKOS_INLINE_FUNCTION
     T pop_back() { return __data[--__len];}
 
     KOKKOS_FUNCTION
     iterator insert(iterator pos, const T& val) {
+      KOKKOS_ASSERT(__len < N);
       for (iterator i = __data + __len; i > pos; i--)
         *i = *(i - 1);
       *pos = val;
@@ -111,15 +119,16 @@ class Array {
  * @class View
  * @brief Dynamic array
  * @details We called view instead of vector here because vector is 3 dimensional
- *     vector here.
+ *     vector here. With Space of host memory, both sides are the same allocation.
  * 
  * @tparam T 
+ * @tparam Space memory space of the device side
  */
-template <typename T>
-class View : public Kokkos::DualView<T*> {
+template <typename T, typename Space = Kokkos::DefaultExecutionSpace::memory_space>
+class View : public Kokkos::DualView<T*, Space> {
   public:
     /// @brief alias of default memory and host mirrorspace
-    using DV = Kokkos::DualView<T*>;
+    using DV = Kokkos::DualView<T*, Space>;
     using MemorySpace = typename DV::t_dev::memory_space;
     using HostMirrorSpace = typename DV::t_host::memory_space;
 
@@ -162,87 +171,354 @@ class View : public Kokkos::DualView<T*> {
     size_t __len;
 }; // class View
 
+/// @brief View only on host, for sources that device structures are built from
+template <typename T>
+using HostView = View<T, Kokkos::HostSpace>;
+
 
 /**
- * @class Vector
- * @brief 3 dimensional vector
- * @details The following functions are operations of vectors.
+ * @class Csr
+ * @brief Compressed sparse row adjacency
+ * @details Row i is indices[offsets[i], offsets[i+1]), in the same order as the
+ *     list it's built from, so rings of curvature keep their order. 32-bit
+ *     indices, offsets and indices are resident on device, built on host.
  */
-class Vector {
+class Csr {
   public:
-    KOKKOS_INLINE_FUNCTION Vector(): __data{0} {}
-    KOKKOS_INLINE_FUNCTION
-    Vector(double i, double j, double k): __data{i, j, k} {}
-    KOKKOS_INLINE_FUNCTION
-    double& operator[](int i) { return __data[i]; }
-    KOKKOS_INLINE_FUNCTION
-    double operator[](int i) const { return __data[i]; }
+    /// @brief one row, iterated like a const Array<int>
+    class Row {
+      public:
+        KOKKOS_INLINE_FUNCTION
+        Row(const int* data, int size): __data(data), __size(size) {}
+        KOKKOS_INLINE_FUNCTION
+        int size() const { return __size; }
+        KOKKOS_INLINE_FUNCTION
+        int operator[](int j) const { return __data[j]; }
+        KOKKOS_INLINE_FUNCTION
+        const int* begin() const { return __data; }
+        KOKKOS_INLINE_FUNCTION
+        const int* end() const { return __data + __size; }
+
+      private:
+        const int* __data;
+        int __size;
+    }; // class Row
+
+    /// @brief build from lists on host, then copy to device. Only entries j of row
+    ///     i with keep(i, lists[i][j]) are kept. Kernels read rows into Array<>, so
+    ///     a longer row aborts, also in release builds
+    template <typename T, typename S, typename F>
+    void build(const View<T, S>& lists, F keep) {
+      offsets.init(lists.size() + 1);
+      offsets[0] = 0;
+      for (int i=0; i<lists.size(); i++) {
+        offsets[i+1] = offsets[i];
+        for (int j=0; j<lists[i].size(); j++)
+          offsets[i+1] += keep(i, lists[i][j]);
+        if (offsets[i+1] - offsets[i] > Array<int>::capacity())
+          Kokkos::abort("Csr: a row has more adjacents than capacity of Array");
+      }
+      indices.init(offsets[lists.size()]);
+      for (int i=0; i<lists.size(); i++) {
+        int k = offsets[i];
+        for (int j=0; j<lists[i].size(); j++)
+          if (keep(i, lists[i][j]))
+            indices[k++] = lists[i][j];
+      }
+      offsets.modify_host();
+      offsets.sync_device();
+      indices.modify_host();
+      indices.sync_device();
+    }
+    template <typename T, typename S>
+    void build(const View<T, S>& lists) { build(lists, [](int, int) { return true; }); }
+
+    /// @brief Capacity
+    inline size_t rows() const { return offsets.size() == 0 ? 0 : offsets.size() - 1; }
+    inline size_t entries() const { return indices.size(); }
+    inline size_t bytes() const { return (offsets.size() + indices.size()) * sizeof(int); }
 
-    /// @brief add, subtract and self-add
+    /// @brief Element access, for device
     KOKKOS_INLINE_FUNCTION
-    Vector operator+(const Vector& p) const {
-      return Vector(__data[0] + p[0], __data[1] + p[1], __data[2] + p[2]);
-    }
+    int offset(int i) const { return offsets(i); }
     KOKKOS_INLINE_FUNCTION
-    Vector operator-() const {
-      return Vector(-__data[0], -__data[1], -__data[2]);
+    Row operator()(int i) const {
+      return Row(indices.d_view.data() + offsets(i), offsets(i+1) - offsets(i));
     }
+
+    View<int> offsets;
+    View<int> indices;
+}; // class Csr
+
+
+/// @brief scalar of energy kernels and stored gradients, float with MIXED_PRECISION.
+///     Positions, velocities and reductions are always double.
+#ifdef MIXED_PRECISION
+using Real = float;
+#else
+using Real = double;
+#endif
+
+/**
+ * @class BasicVector
+ * @brief 3 dimensional vector of scalar T
+ * @details The following functions are operations of vectors. Widening conversion
+ *     (e.g. float to double) is implicit, narrowing one must be explicit.
+ */
+template <typename T>
+class BasicVector {
+  public:
+    KOKKOS_INLINE_FUNCTION BasicVector(): __data{0} {}
     KOKKOS_INLINE_FUNCTION
-    Vector operator-(const Vector& p) const {
-      return Vector(__data[0] - p[0], __data[1] - p[1], __data[2] - p[2]);
-    }
+    BasicVector(T i, T j, T k): __data{i, j, k} {}
+    template <typename U, std::enable_if_t<(sizeof(U) <= sizeof(T)), int> = 0>
     KOKKOS_INLINE_FUNCTION
-    Vector& operator+=(const Vector& p) {
-      __data[0] += p[0]; __data[1] += p[1]; __data[2] += p[2];
-      return *this;
-    }
-
-    /// @brief quantity product
+    BasicVector(const BasicVector<U>& p): __data{T(p[0]), T(p[1]), T(p[2])} {}
+    template <typename U, std::enable_if_t<(sizeof(U) > sizeof(T)), int> = 0>
     KOKKOS_INLINE_FUNCTION
-    Vector operator*(double n) const {
-      return Vector(n * __data[0], n * __data[1], n * __data[2]);
-    }
-    
-    /// @brief 1/n times vector
+    explicit BasicVector(const BasicVector<U>& p): __data{T(p[0]), T(p[1]), T(p[2])} {}
     KOKKOS_INLINE_FUNCTION
-    Vector operator/(double n) const {
-      return Vector(__data[0] / n, __data[1] / n, __data[2] / n);
-    }
-
-    /// @brief dot product of two vectors
+    T& operator[](int i) { return __data[i]; }
     KOKKOS_INLINE_FUNCTION
-    double operator*(const Vector& p) const {
-      return __data[0] * p[0] + __data[1] * p[1] + __data[2] * p[2];
-    }
+    T operator[](int i) const { return __data[i]; }
 
-    /// @brief compare two vectors
-    KOKKOS_INLINE_FUNCTION 
-    bool operator==(const Vector& p) const {
-      return __data[0]==p[0] && __data[1]==p[1] && __data[2]==p[2];
-    }
+    /// @brief self-add of any vector (VectorRef included), other operations are
+    ///     non-member functions
+    template <typename V>
     KOKKOS_INLINE_FUNCTION
-    bool operator!=(const Vector& p) const {
-      return __data[0]!=p[0] || __data[1]!=p[1] || __data[2]!=p[2];
+    BasicVector& operator+=(const V& p) {
+      __data[0] += p[0]; __data[1] += p[1]; __data[2] += p[2];
+      return *this;
     }
 
   private:
-    double __data[3];
-}; // class Vector
+    T __data[3];
+}; // class BasicVector
+
+using Vector = BasicVector<double>;
+using RealVector = BasicVector<Real>;
+
+/// @brief lanes of Real for kernels batched across nodes. Threads of GPUs are
+///     lanes already, so it's a single lane there.
+#if defined(KOKKOS_ENABLE_CUDA) || defined(KOKKOS_ENABLE_HIP) || defined(KOKKOS_ENABLE_SYCL)
+using RealSimd = Kokkos::Experimental::simd<Real, Kokkos::Experimental::simd_abi::scalar>;
+#else
+using RealSimd = Kokkos::Experimental::native_simd<Real>;
+#endif
+
+class VectorRef;
+
+/// @brief scalar of vector types, operators below only accept types defined here
+template <typename V> struct VectorScalar {};
+template <typename T> struct VectorScalar<BasicVector<T>> { using type = T; };
+template <> struct VectorScalar<VectorRef> { using type = double; };
+
+/// @brief vector of V, and vector of the wider scalar of V1 and V2
+template <typename V>
+using VectorOf = BasicVector<typename VectorScalar<V>::type>;
+template <typename V1, typename V2>
+using CommonVector = BasicVector<std::common_type_t<typename VectorScalar<V1>::type,
+    typename VectorScalar<V2>::type>>;
+
+/// @brief add and subtract
+template <typename V1, typename V2>
+KOKKOS_INLINE_FUNCTION
+CommonVector<V1, V2> operator+(const V1& p1, const V2& p2) {
+  return CommonVector<V1, V2>(p1[0] + p2[0], p1[1] + p2[1], p1[2] + p2[2]);
+}
+template <typename V>
+KOKKOS_INLINE_FUNCTION
+VectorOf<V> operator-(const V& p) {
+  return VectorOf<V>(-p[0], -p[1], -p[2]);
+}
+template <typename V1, typename V2>
+KOKKOS_INLINE_FUNCTION
+CommonVector<V1, V2> operator-(const V1& p1, const V2& p2) {
+  return CommonVector<V1, V2>(p1[0] - p2[0], p1[1] - p2[1], p1[2] - p2[2]);
+}
+
+/// @brief quantity product, n is converted to the scalar of p
+template <typename V>
+KOKKOS_INLINE_FUNCTION
+VectorOf<V> operator*(const V& p, typename VectorScalar<V>::type n) {
+  return VectorOf<V>(n * p[0], n * p[1], n * p[2]);
+}
 
 /// @brief quantity product for n on the left hand
+template <typename V>
+KOKKOS_INLINE_FUNCTION
+VectorOf<V> operator*(typename VectorScalar<V>::type n, const V& p) { return p * n; }
+
+/// @brief 1/n times vector
+template <typename V>
+KOKKOS_INLINE_FUNCTION
+VectorOf<V> operator/(const V& p, typename VectorScalar<V>::type n) {
+  return VectorOf<V>(p[0] / n, p[1] / n, p[2] / n);
+}
+
+/// @brief dot product of two vectors
+template <typename V1, typename V2>
+KOKKOS_INLINE_FUNCTION
+typename VectorScalar<CommonVector<V1, V2>>::type operator*(const V1& p1, const V2& p2) {
+  return p1[0] * p2[0] + p1[1] * p2[1] + p1[2] * p2[2];
+}
+
+/// @brief compare two vectors
+template <typename V1, typename V2>
+KOKKOS_INLINE_FUNCTION 
+std::enable_if_t<sizeof(CommonVector<V1, V2>) != 0, bool> operator==(const V1& p1,
+    const V2& p2) {
+  return p1[0]==p2[0] && p1[1]==p2[1] && p1[2]==p2[2];
+}
+template <typename V1, typename V2>
 KOKKOS_INLINE_FUNCTION
-Vector operator*(double n, const Vector& p) { return p * n; }
+std::enable_if_t<sizeof(CommonVector<V1, V2>) != 0, bool> operator!=(const V1& p1,
+    const V2& p2) {
+  return p1[0]!=p2[0] || p1[1]!=p2[1] || p1[2]!=p2[2];
+}
 
 /// @brief cross product of two vectors
+template <typename V1, typename V2>
 KOKKOS_INLINE_FUNCTION
-Vector cross(const Vector& p1, const Vector& p2) {
-  return Vector( p1[1]*p2[2] - p1[2]*p2[1], p1[2]*p2[0] - p1[0]*p2[2],
+CommonVector<V1, V2> cross(const V1& p1, const V2& p2) {
+  return CommonVector<V1, V2>( p1[1]*p2[2] - p1[2]*p2[1], p1[2]*p2[0] - p1[0]*p2[2],
     p1[0]*p2[1] - p1[1]*p2[0]);
 }
 
 /// @brief length of vector p
+template <typename V>
+KOKKOS_INLINE_FUNCTION
+typename VectorScalar<V>::type mod(const V& p) { return Kokkos::sqrt(p * p); }
+
+/// @brief rotate p by rotation vector r (axis times angle), Rodrigues' formula
+template <typename T>
 KOKKOS_INLINE_FUNCTION
-double mod(const Vector& p) { return Kokkos::sqrt(p * p); }
+BasicVector<T> rotate(const BasicVector<T>& p, const BasicVector<T>& r) {
+  T angle = mod(r);
+  if (angle == 0)
+    return p;
+  BasicVector<T> k = r / angle;
+  return p * Kokkos::cos(angle) + cross(k, p) * Kokkos::sin(angle) +
+      k * ((k * p) * (1 - Kokkos::cos(angle)));
+}
+
+/// @brief second moments S = sum t t^T after every t becomes (1 + h [w]x) t,
+///     S = M S M^T, symmetric S is kept as diagonal (xx, yy, zz) and (yz, xz, xy)
+KOKKOS_INLINE_FUNCTION
+void transform_second_moment(Vector& diagonal, Vector& off_diagonal, const Vector& w,
+    double h) {
+  double m[3][3] = {{1, -h*w[2], h*w[1]}, {h*w[2], 1, -h*w[0]}, {-h*w[1], h*w[0], 1}};
+  double s[3][3] = {{diagonal[0], off_diagonal[2], off_diagonal[1]},
+      {off_diagonal[2], diagonal[1], off_diagonal[0]},
+      {off_diagonal[1], off_diagonal[0], diagonal[2]}};
+  double ms[3][3] = {}, result[3][3] = {};
+  for (int i=0; i<3; i++)
+    for (int j=0; j<3; j++)
+      for (int k=0; k<3; k++)
+        ms[i][j] += m[i][k] * s[k][j];
+  for (int i=0; i<3; i++)
+    for (int j=0; j<3; j++)
+      for (int k=0; k<3; k++)
+        result[i][j] += ms[i][k] * m[j][k];
+  diagonal = Vector(result[0][0], result[1][1], result[2][2]);
+  off_diagonal = Vector(result[1][2], result[0][2], result[0][1]);
+}
+
+/// @brief layout of VectorView, structure of arrays (x, y, z are contiguous
+///     respectively) with NODE_LAYOUT_SOA, otherwise the same as an array of Vector
+#ifdef NODE_LAYOUT_SOA
+using NodeLayout = Kokkos::LayoutLeft;
+#else
+using NodeLayout = Kokkos::LayoutRight;
+#endif
+
+/**
+ * @class VectorRef
+ * @brief Reference to a vector inside VectorView
+ * @details Components are strided, so that the same code works with both layouts.
+ *     Assignment writes through, conversion to Vector reads a copy.
+ */
+class VectorRef {
+  public:
+    KOKKOS_INLINE_FUNCTION
+    VectorRef(double* data, size_t stride): __data(data), __stride(stride) {}
+    KOKKOS_INLINE_FUNCTION
+    double& operator[](int i) const { return __data[i*__stride]; }
+    KOKKOS_INLINE_FUNCTION
+    operator Vector() const {
+      return Vector(__data[0], __data[__stride], __data[2*__stride]);
+    }
+
+    KOKKOS_INLINE_FUNCTION
+    const VectorRef& operator=(const Vector& p) const {
+      __data[0] = p[0]; __data[__stride] = p[1]; __data[2*__stride] = p[2];
+      return *this;
+    }
+    KOKKOS_INLINE_FUNCTION
+    const VectorRef& operator=(const VectorRef& p) const { return *this = Vector(p); }
+    KOKKOS_INLINE_FUNCTION
+    const VectorRef& operator+=(const Vector& p) const {
+      __data[0] += p[0]; __data[__stride] += p[1]; __data[2*__stride] += p[2];
+      return *this;
+    }
+    /// @brief += by atomic operations on every component
+    KOKKOS_INLINE_FUNCTION
+    void atomic_add(const Vector& p) const {
+      Kokkos::atomic_add(&__data[0], p[0]);
+      Kokkos::atomic_add(&__data[__stride], p[1]);
+      Kokkos::atomic_add(&__data[2*__stride], p[2]);
+    }
+
+  private:
+    double* __data;
+    size_t __stride;
+}; // class VectorRef
+
+/**
+ * @class VectorView
+ * @brief Dynamic array of vectors, stored as n x 3 doubles in NodeLayout
+ * @details The same interface as View<Vector>, but elements are VectorRef.
+ */
+class VectorView : public Kokkos::DualView<double*[3], NodeLayout> {
+  public:
+    /// @brief alias of default memory and host mirrorspace
+    using DV = Kokkos::DualView<double*[3], NodeLayout>;
+    using MemorySpace = typename DV::t_dev::memory_space;
+    using HostMirrorSpace = typename DV::t_host::memory_space;
+
+    inline VectorView(): __len(0) {}
+
+    /// @brief Constructor
+    inline void init(size_t len, size_t cap) {
+      __len = len;
+      this->realloc(cap);
+    }
+    inline void init(size_t len) { init(len, len); }
+
+    /// @brief Modifiers
+    inline void push_back(const Vector& in) { (*this)[__len++] = in; }
+    inline Vector pop_back() { return (*this)[--__len]; }
+
+    /// @brief Capacity
+    inline size_t size() const { return __len; }
+    inline void resize(size_t n) { __len = n; }
+
+    /// @brief Element access, for host
+    inline VectorRef operator[](int i) const { return __ref(this->h_view, i); }
+
+    /// @brief Element access, for device
+    KOKKOS_INLINE_FUNCTION
+    VectorRef operator()(int i) const { return __ref(this->d_view, i); }
+
+  private:
+    template <typename V>
+    KOKKOS_INLINE_FUNCTION
+    static VectorRef __ref(const V& view, int i) {
+      return VectorRef(&view(i, 0), &view(i, 1) - &view(i, 0));
+    }
+
+    size_t __len;
+}; // class VectorView
 
 /**
  * @class Pair
@@ -309,23 +585,53 @@ class Pair {
 
 /**
  * @brief Random pool for vector generation
- * 
+ * @details Counter based: numbers of a draw only depend on seed, counter and
+ *     stream (node index), never on thread scheduling. So the whole state is two
+ *     integers, which can be stored and loaded for bit-exact restart.
  */
 class Pool {
   public:
-    inline Pool() : __pool(Kokkos::Timer().seconds()) {}
+    inline Pool() : __seed(std::chrono::steady_clock::now().time_since_epoch().count()),
+        __counter(0) {}
+
+    /// @brief random vector of length in [0, end), stream is usually node index
     KOKKOS_INLINE_FUNCTION
-    Vector gen_vector(double end) const {
-      auto generator = __pool.get_state();
-      double r = generator.drand(0, end);
-      double phi = generator.drand(0, 2*PI);
-      double theta = generator.drand(-PI/2, PI/2);
+    Vector gen_vector(double end, uint64_t stream) const {
+      uint64_t key = __seed ^ mix(__counter + 0x9E3779B97F4A7C15ULL * stream);
+      double r = end * uniform(key, 0);
+      double phi = 2*PI * uniform(key, 1);
+      double theta = PI * uniform(key, 2) - PI/2;
       return Vector(r * Kokkos::cos(phi) * Kokkos::sin(theta),
         r * Kokkos::sin(phi) * Kokkos::sin(theta), r * Kokkos::cos(theta));
     }
 
+    /// @brief use new numbers for next draw, call once per step on host
+    inline void advance() { __counter++; }
+
+    /// @brief state of pool, for store and load
+    inline uint64_t seed() const { return __seed; }
+    inline uint64_t counter() const { return __counter; }
+    inline void set_state(uint64_t seed, uint64_t counter) {
+      __seed = seed;
+      __counter = counter;
+    }
+
   private:
-    Kokkos::Random_XorShift64_Pool<> __pool;
+    /// @brief splitmix64 finalizer
+    KOKKOS_INLINE_FUNCTION
+    static uint64_t mix(uint64_t x) {
+      x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+      x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+      return x ^ (x >> 31);
+    }
+    /// @brief the i-th uniform number in [0, 1) of key
+    KOKKOS_INLINE_FUNCTION
+    static double uniform(uint64_t key, uint64_t i) {
+      return (mix(key + 0x9E3779B97F4A7C15ULL * (i + 1)) >> 11) * 0x1.0p-53;
+    }
+
+    uint64_t __seed;
+    uint64_t __counter;
 }; // class Pool
 
 } // namespace CoreMath
@@ -333,11 +639,11 @@ class Pool {
 // reduction identity of Vector, must be defined in Kokkos namespace
 namespace Kokkos {
 
-template<>
-struct reduction_identity<CoreMath::Vector> {
+template <typename T>
+struct reduction_identity<CoreMath::BasicVector<T>> {
   KOKKOS_FORCEINLINE_FUNCTION
-  static CoreMath::Vector sum() {
-    return CoreMath::Vector();
+  static CoreMath::BasicVector<T> sum() {
+    return CoreMath::BasicVector<T>();
   }
 };
 
@@ -12,6 +12,9 @@
 
 #include <stdio.h>
 
+#include <cstdlib>
+#include <string>
+
 #include <Kokkos_Core.hpp>
 
 #include "metadata.h"
@@ -19,11 +22,42 @@
 #include "model/system.h"
 #include "model/initializer.h"
 #include "utils/modifier.h"
+#include "utils/sweep.h"
+
+#ifdef QUADRATUBE_MPI
+#include <mpi.h>
+
+#include "model/decomposition.h"
+#endif
+
+// run every job of a job list concurrently, summaries into <file_name>.summary
+void sweep(const std::string& file_name, int partitions) {
+  auto jobs = UtilsSweep::read_jobs(file_name);
+  UtilsSweep::Runner runner(partitions);
+  auto summaries = runner.run(jobs);
+  UtilsSweep::write_summaries(file_name + ".summary", summaries);
+  for (auto& i : summaries)
+    std::printf("%s: %i nodes, %i steps in %.3f s on partition %i, total energy %.8f\n",
+        i.name.c_str(), i.nodes, i.steps, i.seconds, i.partition,
+        i.bond1_energy + i.bond2_energy + i.curvature_energy);
+}
 
 int main(int argc, char* argv[]) {
   // initialize kokkos in main function instead of class system
   // use {} to limit life cycle, avoiding `deallocate after Kokkos::finalize`
-  Kokkos::initialize(argc, argv); {
+#ifdef QUADRATUBE_MPI
+  MPI_Init(&argc, &argv);
+#endif
+  Kokkos::initialize(argc, argv);
+  // `quadratube jobs.txt [partitions]` runs a parameter sweep instead
+  if (argc > 1) {
+    sweep(argv[1], argc > 2 ? std::atoi(argv[2]) : 0);
+    Kokkos::finalize();
+#ifdef QUADRATUBE_MPI
+    MPI_Finalize();
+#endif
+    return 0;
+  } {
   ModelSystem model;
 
   // set runtime parameters
@@ -31,35 +65,80 @@ int main(int argc, char* argv[]) {
   model.curvature_bending_rigidity_ = 0.1;
   model.damp_coeff_ = 1;
   model.temperature_ = 0;
+  model.thermo_every_ = 1000;
 
+  bool root = true;
+#ifdef QUADRATUBE_MPI
+  // only rank 0 builds the whole tube, others receive their slabs from it
+  int rank;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  root = rank == 0;
+#endif
+  if (root) {
 #ifdef RESTART
-  model.load("restart.bin");
+    model.load("restart.bin");
 #else
-  // initialize model with initializer
-  ModelInitializer::Initializer initializer(model);
-  ModelInitializer::Parameters parameters = {
-    .m = 13, .n = 11, .repeat = 8, .direction = -1, .glide = 5, .climb = 0, .rest_len = 1
-  };
-  initializer.init(parameters);
+    // initialize model with initializer
+    ModelInitializer::Initializer initializer(model);
+    ModelInitializer::Parameters parameters = {
+      .m = 13, .n = 11, .repeat = 8, .direction = -1, .glide = 5, .climb = 0, .rest_len = 1,
+      .reorder = true, .lattice = Metadata::kTriangular
+    };
+    initializer.init(parameters);
+#endif
+  }
+
+#ifdef QUADRATUBE_MPI
+  // every rank keeps its slab of the tube, they are gathered into model of rank 0
+  ModelDecomposition decomposition(model, MPI_COMM_WORLD);
+  auto& system = decomposition.system();
+  auto gather = [&]() { decomposition.gather(); };
+#else
+  auto& system = model;
+  auto gather = []() {};
 #endif
 
   // range of output box
   #define OUT_RANGE CoreMath::Vector(-INFINITY, -INFINITY, 29), CoreMath::Vector(INFINITY, INFINITY, 48)
 
-  for (int k=300000; k>0; k--) {
-    if (k%10000 == 0) {
-      // dump current states
-      model.dump("test", Metadata::kPrintAll);
-      // use modifier to calculate related global quantities
-      UtilsModifier::Modifier modifier(model);
-      std::printf("total particle: %i, total energy: %.8f\n",
-          modifier.total_particle(OUT_RANGE), modifier.total_energy(OUT_RANGE));
+  // use modifier to calculate related global quantities
+  UtilsModifier::Modifier modifier(system);
+  auto output = [&]() {
+    // dump current states
+    gather();
+    if (root)
+      model.dump("test", Metadata::kPrintAll | Metadata::kDumpAsync);
+    auto result = modifier.compute(OUT_RANGE);
+    if (root)
+      std::printf("total particle: %i, total energy: %.8f (bond1 %.8f, bond2 %.8f, "
+          "curvature %.8f)\n", result.particles, result.total_energy(), result.bond1_energy,
+          result.bond2_energy, result.curvature_energy);
+  };
+
+  if (system.temperature_ == 0) {
+    // without thermal noise, overdamped steps only relax to minimum, do it directly
+    ModelSystem::MinimizeParameters minimize_parameters;
+    minimize_parameters.force_tol = 1e-6;
+    output();
+    int steps = system.minimize(minimize_parameters);
+    if (root)
+      std::printf("minimized in %i steps\n", steps);
+    output();
+  } else {
+    for (int k=300000; k>0; k--) {
+      if (k%10000 == 0)
+        output();
+      system.update();
     }
-    model.update();
   }
 
-  model.store("restart.bin");
+  gather();
+  if (root)
+    model.store("restart.bin");
   } Kokkos::finalize(); // deconstruct before finalize
+#ifdef QUADRATUBE_MPI
+  MPI_Finalize();
+#endif
 
   return 0;
 }
@@ -17,6 +17,46 @@
 
 namespace Metadata {
 
+/// @brief lattice of the tube, chosen at runtime by the initializer
+enum Lattice { kTriangular, kQuadrangular };
+
+/**
+ * @brief Energy terms of a lattice, compile-time policy of update
+ * @details Kernels of update are instantiated per policy, and terms that are
+ *     absent aren't compiled into them at all. Potentials and parameters of each
+ *     term are shared by all policies, see EnergyMetaData::Bond1Potential and
+ *     EnergyParameters.
+ * 
+ * @tparam kHasBond2 bonds of type 2 (diagonals of quadrangles)
+ * @tparam kHasCurvature bending energy of nodes
+ */
+template <bool kHasBond2, bool kHasCurvature>
+struct EnergyPolicy {
+  static constexpr bool kBond2 = kHasBond2;
+  static constexpr bool kCurvature = kHasCurvature;
+};
+/// @brief triangles of harmonic bonds with bending
+using TriangularPolicy = EnergyPolicy<false, true>;
+/// @brief quadrangles of harmonic edges and truncated LJ diagonals with bending
+using QuadrangularPolicy = EnergyPolicy<true, true>;
+
+/// @brief parameters of a bond potential, para of CoreEnergy::Harmonic (rest length,
+///     spring constant) or CoreEnergy::Ljts (rest length, coefficient, cutoff length)
+struct BondParameters {
+  double para[3];
+};
+/// @brief parameters of bending, para of CoreEnergy::curvature_energy (bending
+///     rigidity), the second one is reserved
+struct CurvatureParameters {
+  double para[2];
+};
+/// @brief parameters of every energy term, a policy reads those of its terms. Stored
+///     and loaded as EnergyMetaData::kParameterNumber raw doubles
+struct EnergyParameters {
+  BondParameters bond1, bond2;
+  CurvatureParameters curvature;
+};
+
 /**
  * @brief meta data for energy funtions
  * @details Decide which function to use for update
@@ -25,12 +65,12 @@ class EnergyMetaData {
   public:
     /// @brief alias for runtime change, don't use these names in class System,
     ///     in-class initializing can only use in c++11 (and after)
-    double& bond1_rest_length_ = __data[0];
-    double& bond1_spring_constant_ = __data[1];
-    double& bond2_rest_length_ = __data[3];
-    double& bond2_spring_constant_ = __data[4];
-    double& bond2_truncate_length_ = __data[5];
-    double& curvature_bending_rigidity_ = __data[6];
+    double& bond1_rest_length_ = __parameters.bond1.para[0];
+    double& bond1_spring_constant_ = __parameters.bond1.para[1];
+    double& bond2_rest_length_ = __parameters.bond2.para[0];
+    double& bond2_spring_constant_ = __parameters.bond2.para[1];
+    double& bond2_truncate_length_ = __parameters.bond2.para[2];
+    double& curvature_bending_rigidity_ = __parameters.curvature.para[0];
 
     /// @brief step length, mass of each particle, damping coefficient, temperature
     double step_length_ = 1e-2;
@@ -38,38 +78,130 @@ class EnergyMetaData {
     double damp_coeff_ = 1;
     double temperature_ = 0;
 
+    /// @brief lattice of the tube, selects the EnergyPolicy of update
+    Lattice lattice_ = kTriangular;
+    /// @brief call f(policy) with a default constructed EnergyPolicy of lattice_
+    template <typename F>
+    inline void with_policy(F&& f) const {
+      if (lattice_ == kTriangular)
+        f(TriangularPolicy());
+      else
+        f(QuadrangularPolicy());
+    }
+
+    /// @brief pair potentials of bonds, see CoreEnergy::Harmonic for the interface
+    using Bond1Potential = CoreEnergy::Harmonic;
+    using Bond2Potential = CoreEnergy::Ljts;
+    /**
+     * @brief How pair potentials are evaluated
+     * @details kPairAnalytic evaluates the potentials directly. kPairTable
+     *     interpolates splines over r^2 with pair_table_intervals_ intervals, built
+     *     by update_pair_tables() from the analytic form, and falls back to it
+     *     outside the tabulated range.
+     */
+    enum PairScheme { kPairAnalytic, kPairTable };
+    PairScheme pair_scheme_ = kPairAnalytic;
+    int pair_table_intervals_ = 4096;
+    /// @brief (re)build tables if parameters, intervals or lattice changed since the
+    ///     last build, or release them for kPairAnalytic, on host. The table of bonds
+    ///     2 is only built for lattices having them. Called by update.
+    inline void update_pair_tables() {
+      if (pair_scheme_ != kPairTable) {
+        __table1 = __table2 = CoreEnergy::PairTable();
+        return;
+      }
+      bool bond2 = false;
+      with_policy([&](auto policy) { bond2 = decltype(policy)::kBond2; });
+      const double* table_data = reinterpret_cast<const double*>(&__table_parameters);
+      bool same = __table1.size() == pair_table_intervals_ &&
+          __table2.size() == (bond2 ? pair_table_intervals_ : 0);
+      for (int i=0; i<kParameterNumber; i++)
+        same = same && table_data[i] == parameters()[i];
+      if (same)
+        return;
+      __table1.build<Bond1Potential>(__parameters.bond1.para, pair_table_intervals_);
+      if (bond2)
+        __table2.build<Bond2Potential>(__parameters.bond2.para, pair_table_intervals_);
+      else
+        __table2 = CoreEnergy::PairTable();
+      __table_parameters = __parameters;
+    }
+
     /// @brief alias of energy function and gradient function for update and dump
-    ///    function, use these in class System instead of direct CoreEnergy function
+    ///    function, use these in class System instead of direct CoreEnergy function.
+    ///    Scalar follows the argument, Real in kernels of System.
+    template <typename T>
     KOKKOS_INLINE_FUNCTION
-    double bond1_energy(const CoreMath::Vector& other) const {
-      return CoreEnergy::harmonic_energy(__data, other);
+    T bond1_energy(const CoreMath::BasicVector<T>& other) const {
+      return __pair_energy<Bond1Potential>(__parameters.bond1.para, __table1, other);
     }
+    template <typename T>
     KOKKOS_INLINE_FUNCTION
-    CoreMath::Vector bond1_gradient(const CoreMath::Vector& other) const {
-      return CoreEnergy::harmonic_gradient(__data, other);
+    CoreMath::BasicVector<T> bond1_gradient(const CoreMath::BasicVector<T>& other) const {
+      return __pair_gradient<Bond1Potential>(__parameters.bond1.para, __table1, other);
     }
+    template <typename T>
     KOKKOS_INLINE_FUNCTION
-    double bond2_energy(const CoreMath::Vector& other) const {
-      return CoreEnergy::ljts_energy(__data+3, other);
+    T bond2_energy(const CoreMath::BasicVector<T>& other) const {
+      return __pair_energy<Bond2Potential>(__parameters.bond2.para, __table2, other);
     }
+    template <typename T>
     KOKKOS_INLINE_FUNCTION
-    CoreMath::Vector bond2_gradient(const CoreMath::Vector& other) const {
-      return CoreEnergy::ljts_gradient(__data+3, other);
+    CoreMath::BasicVector<T> bond2_gradient(const CoreMath::BasicVector<T>& other) const {
+      return __pair_gradient<Bond2Potential>(__parameters.bond2.para, __table2, other);
     }
+    template <typename T>
     KOKKOS_INLINE_FUNCTION
-    double curvature_energy(const CoreMath::Array<CoreMath::Vector>& others) const {
-      return CoreEnergy::curvature_energy(__data+6, others);
+    T curvature_energy(const CoreMath::Array<CoreMath::BasicVector<T>>& others) const {
+      return CoreEnergy::curvature_energy(__parameters.curvature.para, others);
     }
+    template <typename T>
     KOKKOS_INLINE_FUNCTION
-    CoreMath::Array<CoreMath::Vector> curvature_gradient(
-        const CoreMath::Array<CoreMath::Vector>& others) const {
-      return CoreEnergy::curvature_gradient(__data+6, others);
+    CoreMath::Array<CoreMath::BasicVector<T>> curvature_gradient(
+        const CoreMath::Array<CoreMath::BasicVector<T>>& others) const {
+      return CoreEnergy::curvature_gradient(__parameters.curvature.para, others);
+    }
+
+    /// @brief parameters of every term, typed
+    inline const EnergyParameters& energy_parameters() const { return __parameters; }
+    /// @brief raw parameters of energy functions, for store and load
+    static constexpr int kParameterNumber = 8;
+    static_assert(sizeof(EnergyParameters) == kParameterNumber * sizeof(double),
+        "EnergyParameters must be raw doubles");
+    inline double* parameters() { return reinterpret_cast<double*>(&__parameters); }
+    inline const double* parameters() const {
+      return reinterpret_cast<const double*>(&__parameters);
     }
   
   private:
     /// @brief default parameter settings, we just need to change bond2_spring_constant
     ///     and curvature_bending_rigidity
-    double __data[8] = {1, Kokkos::sqrt(3)/2, 0, Kokkos::sqrt(2), 0.1, 2.5*Kokkos::sqrt(2), 0.1};
+    EnergyParameters __parameters = {{1, Kokkos::sqrt(3)/2, 0},
+        {Kokkos::sqrt(2), 0.1, 2.5*Kokkos::sqrt(2)}, {0.1, 0}};
+
+    /// @brief tables of kPairTable, and parameters they are built with
+    CoreEnergy::PairTable __table1, __table2;
+    EnergyParameters __table_parameters = {};
+
+    /// @brief pair potential of r^2, from table inside its range
+    template <typename Potential, typename T>
+    KOKKOS_INLINE_FUNCTION
+    T __pair_energy(const double* para, const CoreEnergy::PairTable& table,
+        const CoreMath::BasicVector<T>& other) const {
+      T r2 = other * other;
+      if (pair_scheme_ == kPairTable && table.contains(r2))
+        return table.energy(r2);
+      return Potential::energy(para, r2);
+    }
+    template <typename Potential, typename T>
+    KOKKOS_INLINE_FUNCTION
+    CoreMath::BasicVector<T> __pair_gradient(const double* para,
+        const CoreEnergy::PairTable& table, const CoreMath::BasicVector<T>& other) const {
+      T r2 = other * other;
+      if (pair_scheme_ == kPairTable && table.contains(r2))
+        return 2*table.derivative(r2) * other;
+      return 2*Potential::derivative(para, r2) * other;
+    }
 };
 
 typedef uint64_t DumpType;
@@ -82,6 +214,11 @@ const DumpType kExcludeBondType2  = 1 << 1;
 const DumpType kPrintDislocations = 1 << 2;
 /// @brief output velocities of each atom (predifined)
 const DumpType kPrintVelocities   = 1 << 3;
+/// @brief copy a snapshot and write it in background thread (predifined),
+///     away from custom marcos
+const DumpType kDumpAsync         = 1 << 16;
+/// @brief write binary trajectory (.traj) with frame index instead of text (predifined)
+const DumpType kDumpBinary        = 1 << 17;
 
 /// @brief custom marcos (defined by yourself)
 const DumpType kPrintPotentialEnergy   = 1 << 4;
@@ -93,39 +230,116 @@ const DumpType kPrintAll = kPrintBond | kPrintDislocations |
     kPrintVelocities | kPrintPotentialEnergy |
     kPrintGaussianCurvature | kPrintMeanCurvature;
 
+typedef uint8_t NodeFlag;
+
+/// @brief flags of nodes, packed into one byte per node
+/// @brief nodes of dislocations, have different types when output
+const NodeFlag kNodeEmphasis     = 1 << 0;
+/// @brief nodes regarded as rigid bodies, for edge processing
+const NodeFlag kNodeRigid1       = 1 << 1;
+const NodeFlag kNodeNextToRigid1 = 1 << 2;
+const NodeFlag kNodeRigid2       = 1 << 3;
+const NodeFlag kNodeNextToRigid2 = 1 << 4;
+/// @brief copies of nodes owned by another slab of ModelDecomposition, and the
+///     outer layer of them whose adjacents are cut off
+const NodeFlag kNodeGhost        = 1 << 5;
+const NodeFlag kNodeHaloEdge     = 1 << 6;
+
+/// @brief nodes moved as rigid bodies, and nodes without curvature forces
+const NodeFlag kNodeRigid = kNodeRigid1 | kNodeRigid2;
+const NodeFlag kNodeNearRigid = kNodeRigid | kNodeNextToRigid1 | kNodeNextToRigid2 |
+    kNodeHaloEdge;
+
+typedef uint64_t ThermoType;
+
+/// @brief energies of each term
+const ThermoType kThermoEnergy   = 1 << 0;
+/// @brief max |force| of non-rigid nodes
+const ThermoType kThermoMaxForce = 1 << 1;
+/// @brief root mean square velocity of non-rigid nodes
+const ThermoType kThermoVelocity = 1 << 2;
+/// @brief total forces and moments of rigid ends
+const ThermoType kThermoRigid    = 1 << 3;
+
+const ThermoType kThermoAll = kThermoEnergy | kThermoMaxForce | kThermoVelocity | kThermoRigid;
+
 /// @brief simplified writing
-typedef const CoreMath::Array<CoreMath::Vector>& ConstAdjacentNodes;
+typedef const CoreMath::Array<CoreMath::RealVector>& ConstAdjacentNodes;
+
+/// check whether name is in i
+#define DUMP_CHECK(name, i) ((name & i) != 0)
 
 /**
- * @brief metadata for function dump compute (custom compute)
+ * @brief custom per-atom columns of dump (custom compute)
+ * @details Each column is a functor with its name and dump type, evaluated on
+ *     device with relative positions of bonds1, bonds2 and curvature adjacents.
+ *     To add a column, define a functor like these and append it to DumpColumns.
  */
-struct {
-  const char* name;
-  DumpType dump_type;
-  double (*func_num)(EnergyMetaData, ConstAdjacentNodes,
-      ConstAdjacentNodes, ConstAdjacentNodes);
-} const kDumpMetaData[] = {
-  {"c_epot", kPrintPotentialEnergy, [](EnergyMetaData para, ConstAdjacentNodes others1,
-      ConstAdjacentNodes others2, ConstAdjacentNodes others3){
+struct PotentialEnergyColumn {
+  static constexpr const char* name = "c_epot";
+  static constexpr DumpType dump_type = kPrintPotentialEnergy;
+  KOKKOS_INLINE_FUNCTION
+  double operator()(const EnergyMetaData& para, ConstAdjacentNodes others1,
+      ConstAdjacentNodes others2, ConstAdjacentNodes others3) const {
     double count = 0;
     for (int i=0; i<others1.size(); i++)
       count += para.bond1_energy(others1[i]) / 2;
     for (int i=0; i<others2.size(); i++)
       count += para.bond2_energy(others2[i]) / 2;
     return para.curvature_energy(others3) + count;
-  }},
-  {"g_curv", kPrintGaussianCurvature, [](EnergyMetaData, ConstAdjacentNodes,
-      ConstAdjacentNodes, ConstAdjacentNodes others){
+  }
+};
+
+struct GaussianCurvatureColumn {
+  static constexpr const char* name = "g_curv";
+  static constexpr DumpType dump_type = kPrintGaussianCurvature;
+  KOKKOS_INLINE_FUNCTION
+  double operator()(const EnergyMetaData&, ConstAdjacentNodes,
+      ConstAdjacentNodes, ConstAdjacentNodes others) const {
     return CoreEnergy::gaussian_curvature(others);
-  }},
-  {"m_curv", kPrintMeanCurvature, [](EnergyMetaData, ConstAdjacentNodes,
-      ConstAdjacentNodes, ConstAdjacentNodes others){
+  }
+};
+
+struct MeanCurvatureColumn {
+  static constexpr const char* name = "m_curv";
+  static constexpr DumpType dump_type = kPrintMeanCurvature;
+  KOKKOS_INLINE_FUNCTION
+  double operator()(const EnergyMetaData&, ConstAdjacentNodes,
+      ConstAdjacentNodes, ConstAdjacentNodes others) const {
     return CoreEnergy::mean_curvature(others);
-  }}
+  }
 };
 
-/// check whether name is in i
-#define DUMP_CHECK(name, i) ((name & i) != 0)
+/**
+ * @brief compile-time list of columns
+ * 
+ * @tparam Columns 
+ */
+template <typename... Columns>
+struct DumpColumnList {
+  static constexpr int size = sizeof...(Columns);
+  static constexpr const char* names[] = {Columns::name...};
+  static constexpr DumpType dump_types[] = {Columns::dump_type...};
+
+  /// @brief number of columns selected by dump_type
+  static inline int count(DumpType dump_type) {
+    return (static_cast<int>(DUMP_CHECK(Columns::dump_type, dump_type)) + ...);
+  }
+
+  /// @brief evaluate selected columns of one atom in order, result[k] is the k-th
+  KOKKOS_INLINE_FUNCTION
+  static void evaluate(DumpType dump_type, const EnergyMetaData& para,
+      ConstAdjacentNodes others1, ConstAdjacentNodes others2, ConstAdjacentNodes others3,
+      double* result) {
+    int k = 0;
+    ((DUMP_CHECK(Columns::dump_type, dump_type) ?
+        static_cast<void>(result[k++] = Columns()(para, others1, others2, others3)) :
+        static_cast<void>(0)), ...);
+  }
+};
+
+using DumpColumns = DumpColumnList<PotentialEnergyColumn, GaussianCurvatureColumn,
+    MeanCurvatureColumn>;
 
 } // namespace Metadata
 
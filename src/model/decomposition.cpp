@@ -0,0 +1,460 @@
+/**
+ * @file decomposition.cpp
+ * @author Bohan Cao (2110313@mail.nankai.edu.cn)
+ * @brief Axial domain decomposition of molecular system over MPI ranks
+ * @version 0.0.1
+ * @date 2023-03-28
+ *
+ * @copyright Copyright (c) 2023
+ */
+#include "model/decomposition.h"
+
+#ifdef QUADRATUBE_MPI
+
+#include <algorithm>
+#include <climits>
+#include <cstdint>
+#include <cstring>
+#include <numeric>
+#include <type_traits>
+
+#include <Kokkos_Core.hpp>
+
+#include "core/math.h"
+#include "metadata.h"
+
+// vectors are sent as 3 doubles
+static_assert(sizeof(CoreMath::Vector) == 3 * sizeof(double), "Vector must be packed");
+
+namespace {
+
+/// @brief parts of every slab built by rank 0, part q is [offsets[q], offsets[q+1])
+template <typename T>
+struct Parts {
+  std::vector<T> data;
+  std::vector<int> offsets = {0};
+  inline void close() { offsets.push_back(data.size()); }
+};
+
+/// @brief part of the calling rank of those built by rank 0. Collective, parts are
+///     sent as bytes by MPI_Scatterv
+template <typename T>
+std::vector<T> scatter(const Parts<T>& parts, MPI_Comm comm) {
+  static_assert(std::is_trivially_copyable<T>::value, "parts are sent as bytes");
+  int rank, size;
+  MPI_Comm_rank(comm, &rank);
+  MPI_Comm_size(comm, &size);
+  std::vector<int> counts, displacements;
+  if (rank == 0) {
+    if (parts.data.size() * sizeof(T) > INT_MAX)
+      Kokkos::abort("ModelDecomposition: slabs are too large to be scattered");
+    for (int q=0; q<size; q++) {
+      displacements.push_back(sizeof(T) * parts.offsets[q]);
+      counts.push_back(sizeof(T) * (parts.offsets[q + 1] - parts.offsets[q]));
+    }
+  }
+  int count = 0;
+  MPI_Scatter(counts.data(), 1, MPI_INT, &count, 1, MPI_INT, 0, comm);
+  std::vector<T> part(count / sizeof(T));
+  MPI_Scatterv(parts.data.data(), counts.data(), displacements.data(), MPI_BYTE,
+      part.data(), count, MPI_BYTE, 0, comm);
+  return part;
+}
+
+} // namespace
+
+ModelDecomposition::ModelDecomposition(ModelSystem& global, MPI_Comm comm): __comm(comm) {
+  MPI_Comm_rank(__comm, &__rank);
+  MPI_Comm_size(__comm, &__size);
+  int n = 0;
+  if (__rank == 0) {
+    global.__for_each_view([](const char*, auto& view) {
+      view.template sync<HostMirrorSpace>();
+    });
+    n = global.node_positions_.size();
+  }
+  MPI_Bcast(&n, 1, MPI_INT, 0, __comm);
+  if (n == 0)
+    Kokkos::abort("ModelDecomposition: rank 0 has no system");
+
+  // every slab is built by rank 0 and sent to its rank, so that other ranks never
+  // hold the whole system
+  Parts<int> owned, globals, ids, halo_neighbours, halo_send, halo_recv;
+  Parts<CoreMath::Vector> positions, velocities;
+  Parts<Metadata::NodeFlag> flags;
+  Parts<CoreMath::Array<int>> adjacents[3];
+  Parts<CoreMath::Pair<int>> relations[2];
+  if (__rank == 0) {
+    // slabs of equal node numbers along z, ties broken by index
+    std::vector<int> order(n), owner(n);
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](int i, int j) {
+      return global.node_positions_[i][2] < global.node_positions_[j][2];
+    });
+    for (int k=0; k<n; k++)
+      owner[order[k]] = static_cast<int64_t>(k) * __size / n;
+
+    // neighbours by any kind of adjacents, the same as reorder
+    const CoreMath::HostView<CoreMath::Array<int>>* lists[3] = {
+        &global.node_adjacents_bonds1_, &global.node_adjacents_bonds2_,
+        &global.node_adjacents_curvature_};
+    auto for_each_adjacent = [&](int i, auto f) {
+      for (auto list : lists)
+        for (int j=0; j<(*list)[i].size(); j++)
+          f((*list)[i][j]);
+    };
+
+    // reset after every slab, only entries of its nodes are touched
+    std::vector<int> depth(n, -1), local(n, -1);
+    for (int p=0; p<__size; p++) {
+      // owned nodes, then ghosts within two adjacents of them, both ascending
+      std::vector<int> nodes, layer, ghosts;
+      for (int i=0; i<n; i++)
+        if (owner[i] == p) {
+          depth[i] = 0;
+          nodes.push_back(i);
+        }
+      int count = nodes.size();
+      layer = nodes;
+      for (int d=1; d<=2; d++) {
+        std::vector<int> next;
+        for (auto i : layer)
+          for_each_adjacent(i, [&](int j) {
+            if (depth[j] < 0) {
+              depth[j] = d;
+              next.push_back(j);
+            }
+          });
+        ghosts.insert(ghosts.end(), next.begin(), next.end());
+        layer.swap(next);
+      }
+      std::sort(ghosts.begin(), ghosts.end());
+      nodes.insert(nodes.end(), ghosts.begin(), ghosts.end());
+      int m = nodes.size();
+      for (int k=0; k<m; k++)
+        local[nodes[k]] = k;
+
+      // nodes of the slab, adjacents outside it are dropped (outer ghosts only)
+      owned.data.push_back(count);
+      for (int k=0; k<m; k++) {
+        int i = nodes[k];
+        globals.data.push_back(i);
+        positions.data.push_back(global.node_positions_[i]);
+        velocities.data.push_back(global.node_velocities_[i]);
+        flags.data.push_back(global.node_flags_[i] |
+            ((depth[i] > 0) ? Metadata::kNodeGhost : 0) |
+            ((depth[i] == 2) ? Metadata::kNodeHaloEdge : 0));
+        ids.data.push_back((global.node_ids_.size() == 0) ? i : global.node_ids_[i]);
+        for (int l=0; l<3; l++) {
+          const auto& from = (*lists[l])[i];
+          CoreMath::Array<int> to;
+          for (int j=0; j<from.size(); j++)
+            if (local[from[j]] >= 0)
+              to.push_back(local[from[j]]);
+          adjacents[l].data.push_back(to);
+        }
+      }
+      // bonds inside the slab, for bond schemes and dump
+      const CoreMath::View<CoreMath::Pair<int>>* bonds[2] = {&global.bond_relations1_,
+          &global.bond_relations2_};
+      for (int l=0; l<2; l++)
+        for (int k=0; k<bonds[l]->size(); k++) {
+          int a = local[(*bonds[l])[k][0]], b = local[(*bonds[l])[k][1]];
+          if (a >= 0 && b >= 0)
+            relations[l].data.push_back(CoreMath::Pair<int>(a, b));
+        }
+
+      // owned nodes are sent to slabs having them as ghosts, the owners of nodes
+      // within two adjacents of them. Neighbours are (slab, sends, receives)
+      std::vector<std::vector<int>> send(__size), recv(__size);
+      std::vector<int> stamp(__size, -1);
+      for (int k=0; k<count; k++) {
+        auto mark = [&](int j) {
+          int q = owner[j];
+          if (q != p && stamp[q] != k) {
+            stamp[q] = k;
+            send[q].push_back(k);
+          }
+        };
+        for_each_adjacent(nodes[k], [&](int j) {
+          mark(j);
+          for_each_adjacent(j, mark);
+        });
+      }
+      for (int k=count; k<m; k++)
+        recv[owner[nodes[k]]].push_back(k);
+      for (int q=0; q<__size; q++) {
+        if (send[q].empty() && recv[q].empty())
+          continue;
+        halo_neighbours.data.insert(halo_neighbours.data.end(), {q,
+            static_cast<int>(send[q].size()), static_cast<int>(recv[q].size())});
+        halo_send.data.insert(halo_send.data.end(), send[q].begin(), send[q].end());
+        halo_recv.data.insert(halo_recv.data.end(), recv[q].begin(), recv[q].end());
+      }
+
+      for (auto i : nodes)
+        depth[i] = local[i] = -1;
+      for (auto parts : {&owned, &globals, &ids, &halo_neighbours, &halo_send, &halo_recv})
+        parts->close();
+      positions.close();
+      velocities.close();
+      flags.close();
+      for (auto& parts : adjacents)
+        parts.close();
+      for (auto& parts : relations)
+        parts.close();
+    }
+  }
+
+  __owned = scatter(owned, __comm)[0];
+  auto& s = __system;
+  auto scatter_into = [&](const auto& parts, auto& view) {
+    auto part = scatter(parts, __comm);
+    view.init(part.size());
+    for (int k=0; k<part.size(); k++)
+      view[k] = part[k];
+  };
+  scatter_into(globals, node_globals_);
+  scatter_into(positions, s.node_positions_);
+  scatter_into(velocities, s.node_velocities_);
+  scatter_into(flags, s.node_flags_);
+  scatter_into(ids, s.node_ids_);
+  scatter_into(adjacents[0], s.node_adjacents_bonds1_);
+  scatter_into(adjacents[1], s.node_adjacents_bonds2_);
+  scatter_into(adjacents[2], s.node_adjacents_curvature_);
+  scatter_into(relations[0], s.bond_relations1_);
+  scatter_into(relations[1], s.bond_relations2_);
+  for (int k=0; k<__owned; k++) {
+    auto flag = s.node_flags_[k];
+    s.node_if_emphasis_count_ += static_cast<bool>(flag & Metadata::kNodeEmphasis);
+    s.node_if_rigid1_count_ += static_cast<bool>(flag & Metadata::kNodeRigid1);
+    s.node_if_next_to_rigid1_count_ += static_cast<bool>(flag & Metadata::kNodeNextToRigid1);
+    s.node_if_rigid2_count_ += static_cast<bool>(flag & Metadata::kNodeRigid2);
+    s.node_if_next_to_rigid2_count_ += static_cast<bool>(flag & Metadata::kNodeNextToRigid2);
+  }
+  s.__for_each_view([](const char*, auto& view) {
+    view.modify_host();
+    view.sync_device();
+  });
+  node_globals_.modify_host();
+  node_globals_.sync_device();
+  s.node_streams_ = node_globals_;
+
+  // parameters and state of rank 0, with its random seed
+  if (__rank == 0) {
+    std::memcpy(s.parameters(), global.parameters(),
+        sizeof(double) * Metadata::EnergyMetaData::kParameterNumber);
+    s.step_length_ = global.step_length_;
+    s.mass_ = global.mass_;
+    s.damp_coeff_ = global.damp_coeff_;
+    s.temperature_ = global.temperature_;
+    s.lattice_ = global.lattice_;
+    s.pair_scheme_ = global.pair_scheme_;
+    s.pair_table_intervals_ = global.pair_table_intervals_;
+    // steps are the same on every rank, the first one logs them
+    s.adaptive_step_ = global.adaptive_step_;
+    s.fused_step_ = global.fused_step_;
+    s.bond_scheme_ = global.bond_scheme_;
+    s.curvature_scheme_ = global.curvature_scheme_;
+    s.thermo_every_ = global.thermo_every_;
+    s.thermo_type_ = global.thermo_type_;
+    s.__time_step = global.__time_step;
+    s.__thermo = global.__thermo;
+    s.rand_pool_.set_state(global.rand_pool_.seed(), global.rand_pool_.counter());
+  }
+  s.execution_space_ = global.execution_space_;
+  auto broadcast = [&](auto& value) {
+    static_assert(std::is_trivially_copyable<std::decay_t<decltype(value)>>::value,
+        "values are sent as bytes");
+    MPI_Bcast(&value, sizeof(value), MPI_BYTE, 0, __comm);
+  };
+  MPI_Bcast(s.parameters(), Metadata::EnergyMetaData::kParameterNumber, MPI_DOUBLE, 0,
+      __comm);
+  broadcast(s.step_length_);
+  broadcast(s.mass_);
+  broadcast(s.damp_coeff_);
+  broadcast(s.temperature_);
+  broadcast(s.lattice_);
+  broadcast(s.pair_scheme_);
+  broadcast(s.pair_table_intervals_);
+  auto& adaptive = s.adaptive_step_;
+  broadcast(adaptive.enable);
+  broadcast(adaptive.max_move);
+  broadcast(adaptive.max_change);
+  broadcast(adaptive.min_step);
+  broadcast(adaptive.max_step);
+  broadcast(adaptive.growth);
+  broadcast(adaptive.noise_step);
+  broadcast(s.fused_step_);
+  broadcast(s.bond_scheme_);
+  broadcast(s.curvature_scheme_);
+  broadcast(s.thermo_every_);
+  broadcast(s.thermo_type_);
+  broadcast(s.__time_step);
+  broadcast(s.__thermo);
+  uint64_t state[2] = {s.rand_pool_.seed(), s.rand_pool_.counter()};
+  MPI_Bcast(state, 2, MPI_UINT64_T, 0, __comm);
+  s.rand_pool_.set_state(state[0], state[1]);
+
+  s.resize_workspace();
+  // rigid bodies are whole in the global system, continue with them
+  auto& w = s.__workspace;
+  if (__rank == 0) {
+    auto& g = global.__workspace;
+    w.center1 = g.center1;
+    w.diagonal1 = g.diagonal1;
+    w.off_diagonal1 = g.off_diagonal1;
+    w.center2 = g.center2;
+    w.diagonal2 = g.diagonal2;
+    w.off_diagonal2 = g.off_diagonal2;
+    w.rigid_time_step = g.rigid_time_step;
+    __global = &global;
+  }
+  broadcast(w.center1);
+  broadcast(w.diagonal1);
+  broadcast(w.off_diagonal1);
+  broadcast(w.center2);
+  broadcast(w.diagonal2);
+  broadcast(w.off_diagonal2);
+  broadcast(w.rigid_time_step);
+  s.__decomposition = this;
+
+  // halo lists of the slab, ascending in the whole system in every neighbour
+  auto neighbours = scatter(halo_neighbours, __comm);
+  auto send = scatter(halo_send, __comm);
+  auto recv = scatter(halo_recv, __comm);
+  auto& h = __halo;
+  h.send_offsets.assign(1, 0);
+  h.recv_offsets.assign(1, 0);
+  for (int k=0; k<neighbours.size(); k+=3) {
+    h.neighbours.push_back(neighbours[k]);
+    h.send_offsets.push_back(h.send_offsets.back() + neighbours[k + 1]);
+    h.recv_offsets.push_back(h.recv_offsets.back() + neighbours[k + 2]);
+  }
+  h.send_nodes.init(send.size());
+  h.recv_nodes.init(recv.size());
+  for (int k=0; k<send.size(); k++)
+    h.send_nodes[k] = send[k];
+  for (int k=0; k<recv.size(); k++)
+    h.recv_nodes[k] = recv[k];
+  for (auto view : {&h.send_nodes, &h.recv_nodes}) {
+    view->modify_host();
+    view->sync_device();
+  }
+  Kokkos::realloc(h.send_buffer, h.send_nodes.size());
+  Kokkos::realloc(h.recv_buffer, h.recv_nodes.size());
+  h.host_send = Kokkos::create_mirror_view(h.send_buffer);
+  h.host_recv = Kokkos::create_mirror_view(h.recv_buffer);
+  h.requests.resize(2 * h.neighbours.size());
+}
+
+void ModelDecomposition::allreduce(double* values, int count, bool max) const {
+  MPI_Allreduce(MPI_IN_PLACE, values, count, MPI_DOUBLE, max ? MPI_MAX : MPI_SUM, __comm);
+}
+
+void ModelDecomposition::exchange_halo() {
+  auto& h = __halo;
+  if (h.neighbours.empty())
+    return;
+  auto& space = __system.execution_space_;
+  auto positions = __system.node_positions_;
+  auto send_nodes = h.send_nodes, recv_nodes = h.recv_nodes;
+  auto send_buffer = h.send_buffer, recv_buffer = h.recv_buffer;
+  positions.sync<MemorySpace>();
+  Kokkos::parallel_for(Kokkos::RangePolicy<ModelSystem::ExecutionSpace>(space, 0,
+      send_nodes.size()), KOKKOS_LAMBDA(const int k) {
+    send_buffer(k) = positions(send_nodes(k));
+  });
+  Kokkos::deep_copy(space, h.host_send, send_buffer);
+  space.fence();
+
+  auto send = reinterpret_cast<double*>(h.host_send.data());
+  auto recv = reinterpret_cast<double*>(h.host_recv.data());
+  for (int k=0; k<h.neighbours.size(); k++) {
+    MPI_Irecv(recv + 3*h.recv_offsets[k], 3*(h.recv_offsets[k+1] - h.recv_offsets[k]),
+        MPI_DOUBLE, h.neighbours[k], 0, __comm, &h.requests[2*k]);
+    MPI_Isend(send + 3*h.send_offsets[k], 3*(h.send_offsets[k+1] - h.send_offsets[k]),
+        MPI_DOUBLE, h.neighbours[k], 0, __comm, &h.requests[2*k + 1]);
+  }
+  MPI_Waitall(h.requests.size(), h.requests.data(), MPI_STATUSES_IGNORE);
+
+  Kokkos::deep_copy(space, recv_buffer, h.host_recv);
+  Kokkos::parallel_for(Kokkos::RangePolicy<ModelSystem::ExecutionSpace>(space, 0,
+      recv_nodes.size()), KOKKOS_LAMBDA(const int k) {
+    positions(recv_nodes(k)) = recv_buffer(k);
+  });
+  positions.modify<MemorySpace>();
+  space.fence();
+}
+
+void ModelDecomposition::gather() {
+  auto& s = __system;
+  s.node_positions_.sync<HostMirrorSpace>();
+  s.node_velocities_.sync<HostMirrorSpace>();
+  // owned nodes as rows of position and velocity, with their global indices
+  std::vector<int> indices(__owned);
+  std::vector<double> rows(6 * __owned);
+  for (int k=0; k<__owned; k++) {
+    indices[k] = node_globals_[k];
+    for (int d=0; d<3; d++) {
+      rows[6*k + d] = s.node_positions_[k][d];
+      rows[6*k + 3 + d] = s.node_velocities_[k][d];
+    }
+  }
+
+  std::vector<int> counts(__size), offsets(__size), row_counts(__size), row_offsets(__size);
+  MPI_Gather(&__owned, 1, MPI_INT, counts.data(), 1, MPI_INT, 0, __comm);
+  int n = 0;
+  for (int q=0; q<__size; q++) {
+    offsets[q] = n;
+    n += counts[q];
+    row_counts[q] = 6 * counts[q];
+    row_offsets[q] = 6 * offsets[q];
+  }
+  std::vector<int> all_indices(n);
+  std::vector<double> all_rows(6 * n);
+  MPI_Gatherv(indices.data(), __owned, MPI_INT, all_indices.data(), counts.data(),
+      offsets.data(), MPI_INT, 0, __comm);
+  MPI_Gatherv(rows.data(), 6 * __owned, MPI_DOUBLE, all_rows.data(), row_counts.data(),
+      row_offsets.data(), MPI_DOUBLE, 0, __comm);
+  if (__rank != 0)
+    return;
+
+  // rows go to host views of the whole system only, its device views are synced by
+  // whatever reads them next (dump or modifier)
+  auto& g = *__global;
+  for (int k=0; k<n; k++) {
+    int i = all_indices[k];
+    g.node_positions_[i] = CoreMath::Vector(all_rows[6*k], all_rows[6*k + 1], all_rows[6*k + 2]);
+    g.node_velocities_[i] = CoreMath::Vector(all_rows[6*k + 3], all_rows[6*k + 4],
+        all_rows[6*k + 5]);
+  }
+  g.node_positions_.modify<HostMirrorSpace>();
+  g.node_velocities_.modify<HostMirrorSpace>();
+  g.__time_step = s.__time_step;
+  g.__thermo = s.__thermo;
+  g.step_length_ = s.step_length_;
+  g.rand_pool_.set_state(s.rand_pool_.seed(), s.rand_pool_.counter());
+  auto& w = g.__workspace;
+  w.center1 = s.__workspace.center1;
+  w.diagonal1 = s.__workspace.diagonal1;
+  w.off_diagonal1 = s.__workspace.off_diagonal1;
+  w.center2 = s.__workspace.center2;
+  w.diagonal2 = s.__workspace.diagonal2;
+  w.off_diagonal2 = s.__workspace.off_diagonal2;
+  w.rigid_time_step = s.__workspace.rigid_time_step;
+  w.backup_time_step = -1;
+}
+
+void ModelDecomposition::dump(std::string file_name, Metadata::DumpType dump_type,
+    bool gathered) {
+  if (!gathered) {
+    __system.dump(file_name + "." + std::to_string(__rank), dump_type);
+    return;
+  }
+  gather();
+  if (__rank == 0)
+    __global->dump(file_name, dump_type);
+}
+
+#endif // QUADRATUBE_MPI
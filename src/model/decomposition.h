@@ -0,0 +1,107 @@
+/**
+ * @file decomposition.h
+ * @author Bohan Cao (2110313@mail.nankai.edu.cn)
+ * @brief Axial domain decomposition of molecular system over MPI ranks
+ * @version 0.0.1
+ * @date 2023-03-28
+ *
+ * @copyright Copyright (c) 2023
+ */
+#ifndef QUADRATUBE_MODEL_DECOMPOSITION_H_
+#define QUADRATUBE_MODEL_DECOMPOSITION_H_
+
+// only built with MPI, see option MPI of CMakeLists.txt
+#ifdef QUADRATUBE_MPI
+
+#include <string>
+#include <vector>
+
+#include <mpi.h>
+#include <Kokkos_Core.hpp>
+
+#include "metadata.h"
+#include "core/math.h"
+#include "model/system.h"
+
+/**
+ * @class ModelDecomposition
+ * @brief Slabs of a long tube along z, one per MPI rank
+ * @details Nodes are split by z at construction into slabs of equal node numbers.
+ *     The slab of a rank is a ModelSystem of its owned nodes followed by ghosts,
+ *     nodes of other slabs within two adjacents (of any kind) of owned ones, so that
+ *     bonds and curvature rings of owned nodes and of their adjacents are complete.
+ *     The outer layer of ghosts (Metadata::kNodeHaloEdge) keeps adjacents inside the
+ *     slab only and has no curvature forces. Adjacents never change, so nodes stay
+ *     in their slabs however they move.
+ *
+ *     update() and minimize() of the slab are those of ModelSystem. Forces of owned
+ *     nodes are the same as in the whole system, thermo and rigid bodies are reduced
+ *     over slabs by allreduce(), and ghosts are refreshed by their owners after every
+ *     move. Random forces are drawn with the seed of rank 0 and indices of the whole
+ *     system as streams, so noises don't depend on the number of slabs.
+ */
+class ModelDecomposition {
+  public:
+    using MemorySpace = ModelSystem::MemorySpace;
+    using HostMirrorSpace = ModelSystem::HostMirrorSpace;
+
+    /// @brief slab of this rank, collective. global is only read on rank 0, which
+    ///     builds every slab from it and sends them by MPI_Scatterv, other ranks pass
+    ///     a system that is not built and never hold the whole one. global of rank 0
+    ///     is kept as the target of gather().
+    ModelDecomposition(ModelSystem& global, MPI_Comm comm);
+    ModelDecomposition(const ModelDecomposition&) = delete;
+    ModelDecomposition& operator=(const ModelDecomposition&) = delete;
+
+    /// @brief slab of this rank, configure and advance it like a whole system
+    inline ModelSystem& system() { return __system; }
+    inline int rank() const { return __rank; }
+    inline int size() const { return __size; }
+    /// @brief nodes owned by this slab, the first ones of system()
+    inline int owned_nodes() const { return __owned; }
+
+    /// @brief copy positions, velocities, time step and random state of every slab
+    ///     into the whole system of rank 0, for store or modifier there. Collective.
+    ///     Only host views of positions and velocities are written, sync them to
+    ///     device before advancing the whole system itself.
+    void gather();
+    /// @brief gathered and written by rank 0 (collective), or written by every rank
+    ///     into <file_name>.<rank> with its halo. Ids are those of the whole system.
+    void dump(std::string file_name, Metadata::DumpType dump_type, bool gathered = true);
+
+    /// @brief sums (or maxima) over slabs, see ModelSystem::allreduce()
+    void allreduce(double* values, int count, bool max) const;
+    /// @brief copy positions of owned nodes to the ghosts of them in other slabs
+    void exchange_halo();
+
+    /// @brief index in the whole system of every node of the slab, also the streams
+    ///     of random forces of the slab
+    CoreMath::View<int> node_globals_;
+
+  private:
+    MPI_Comm __comm;
+    int __rank, __size;
+    int __owned = 0;
+    ModelSystem __system;
+    /// @brief whole system of rank 0, null on other ranks
+    ModelSystem* __global = nullptr;
+
+    /**
+     * @brief Exchange of ghosts
+     * @details Owned nodes sent to the k-th neighbouring slab are send_nodes in
+     *     [send_offsets[k], send_offsets[k+1]), ghosts received from it are recv_nodes
+     *     in [recv_offsets[k], recv_offsets[k+1]). Both are ascending in the whole
+     *     system, so that they pair up. Positions are packed on device.
+     */
+    struct Halo {
+      std::vector<int> neighbours, send_offsets, recv_offsets;
+      CoreMath::View<int> send_nodes, recv_nodes;
+      Kokkos::View<CoreMath::Vector*> send_buffer, recv_buffer;
+      Kokkos::View<CoreMath::Vector*>::HostMirror host_send, host_recv;
+      std::vector<MPI_Request> requests;
+    } __halo;
+}; // class ModelDecomposition
+
+#endif // QUADRATUBE_MPI
+
+#endif // QUADRATUBE_MODEL_DECOMPOSITION_H_
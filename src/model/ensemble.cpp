@@ -0,0 +1,377 @@
+/**
+ * @file ensemble.cpp
+ * @author Bohan Cao (2110313@mail.nankai.edu.cn)
+ * @brief Replicas of molecular system advanced together
+ * @version 0.0.1
+ * @date 2023-03-24
+ *
+ * @copyright Copyright (c) 2023
+ */
+#include "model/ensemble.h"
+
+#include <stdio.h>
+
+#include <string>
+#include <utility>
+
+#include <Kokkos_Core.hpp>
+
+#include "core/energy.h"
+#include "core/math.h"
+#include "metadata.h"
+
+namespace {
+
+/// @brief energy functions of a replica for the shared bodies of ModelSystem, with
+///     analytic pair potentials
+struct ReplicaEnergy {
+  using Bond1Potential = Metadata::EnergyMetaData::Bond1Potential;
+  using Bond2Potential = Metadata::EnergyMetaData::Bond2Potential;
+  const Metadata::EnergyParameters& para;
+
+  KOKKOS_INLINE_FUNCTION
+  CoreMath::Real bond1_energy(const CoreMath::RealVector& other) const {
+    return Bond1Potential::energy(para.bond1.para, other * other);
+  }
+  KOKKOS_INLINE_FUNCTION
+  CoreMath::RealVector bond1_gradient(const CoreMath::RealVector& other) const {
+    return 2*Bond1Potential::derivative(para.bond1.para, other * other) * other;
+  }
+  KOKKOS_INLINE_FUNCTION
+  CoreMath::Real bond2_energy(const CoreMath::RealVector& other) const {
+    return Bond2Potential::energy(para.bond2.para, other * other);
+  }
+  KOKKOS_INLINE_FUNCTION
+  CoreMath::RealVector bond2_gradient(const CoreMath::RealVector& other) const {
+    return 2*Bond2Potential::derivative(para.bond2.para, other * other) * other;
+  }
+  KOKKOS_INLINE_FUNCTION
+  CoreMath::Real curvature_energy(const CoreMath::Array<CoreMath::RealVector>& others) const {
+    return CoreEnergy::curvature_energy(para.curvature.para, others);
+  }
+  KOKKOS_INLINE_FUNCTION
+  CoreMath::Array<CoreMath::RealVector> curvature_gradient(
+      const CoreMath::Array<CoreMath::RealVector>& others) const {
+    return CoreEnergy::curvature_gradient(para.curvature.para, others);
+  }
+};
+
+} // namespace
+
+ModelEnsemble::ModelEnsemble(int replicas) {
+  for (int k=0; k<replicas; k++)
+    __replicas.emplace_back(new ModelSystem());
+}
+
+void ModelEnsemble::pack() {
+  int count = replicas();
+  for (int k=0; k<count; k++) {
+    auto& r = replica(k);
+    if (r.pair_scheme_ != Metadata::EnergyMetaData::kPairAnalytic ||
+        r.bond_scheme_ != ModelSystem::kBondGather ||
+        r.curvature_scheme_ != ModelSystem::kCurvatureGather || r.adaptive_step_.enable)
+      Kokkos::abort(("pack: replica " + std::to_string(k) + " needs kPairAnalytic, "
+          "kBondGather, kCurvatureGather and no adaptive step").c_str());
+  }
+  replica_offsets_.init(count + 1);
+  replica_offsets_[0] = 0;
+  __policy_replica = 0;
+  for (int k=0; k<count; k++) {
+    replica_offsets_[k+1] = replica_offsets_[k] + replica(k).node_positions_.size();
+    // the quadrangular policy has every term of the triangular one
+    if (replica(k).lattice_ == Metadata::kQuadrangular)
+      __policy_replica = k;
+  }
+  replica_offsets_.modify_host();
+  replica_offsets_.sync_device();
+
+  // nodes and adjacents, indices are shifted by offsets of replicas
+  int nodes = replica_offsets_[count];
+  node_positions_.init(nodes);
+  node_velocities_.init(nodes);
+  node_flags_.init(nodes);
+  node_replicas_.init(nodes);
+  CoreMath::HostView<CoreMath::Array<int>> bonds1, bonds2, curvature;
+  bonds1.init(nodes);
+  bonds2.init(nodes);
+  curvature.init(nodes);
+  for (int k=0; k<count; k++) {
+    auto& r = replica(k);
+    int offset = replica_offsets_[k];
+    auto shift = [=](CoreMath::Array<int> list) {
+      for (auto& j : list)
+        j += offset;
+      return list;
+    };
+    r.node_positions_.sync<HostMirrorSpace>();
+    for (int i=0; i<r.node_positions_.size(); i++) {
+      node_positions_[offset + i] = r.node_positions_[i];
+      node_velocities_[offset + i] = CoreMath::Vector();
+      node_flags_[offset + i] = r.node_flags_[i];
+      node_replicas_[offset + i] = k;
+      bonds1[offset + i] = shift(r.node_adjacents_bonds1_[i]);
+      bonds2[offset + i] = shift(r.node_adjacents_bonds2_[i]);
+      curvature[offset + i] = shift(r.node_adjacents_curvature_[i]);
+    }
+  }
+  node_positions_.modify<HostMirrorSpace>();
+  node_positions_.sync<MemorySpace>();
+  node_velocities_.modify<HostMirrorSpace>();
+  node_velocities_.sync<MemorySpace>();
+  node_flags_.modify_host();
+  node_flags_.sync_device();
+  node_replicas_.modify_host();
+  node_replicas_.sync_device();
+
+  // compressed adjacents, built like ModelSystem::resize_workspace()
+  csr_bonds1_.build(bonds1);
+  csr_bonds2_.build(bonds2);
+  csr_curvature_.build(curvature);
+  // rows of a replica are contiguous, so its reverse entries are shifted by its first
+  csr_curvature_reverse_.init(csr_curvature_.entries());
+  for (int k=0; k<count; k++) {
+    auto& reverse = replica(k).csr_curvature_reverse_;
+    int first = csr_curvature_.offsets[replica_offsets_[k]];
+    for (int e=0; e<reverse.size(); e++)
+      csr_curvature_reverse_[first + e] = first + reverse[e];
+  }
+  csr_curvature_reverse_.modify_host();
+  csr_curvature_reverse_.sync_device();
+  auto force = [&](int i, int j) {
+    return !((node_flags_[i] & Metadata::kNodeRigid) && (node_flags_[j] & Metadata::kNodeRigid));
+  };
+  csr_force_bonds1_.build(bonds1, force);
+  csr_force_bonds2_.build(bonds2, force);
+
+  // rigid nodes body by body, ascending in every body
+  rigid_nodes_.init(0, nodes);
+  rigid_bodies_.init(0, nodes);
+  rigid_offsets_.init(0, 2*count + 1);
+  for (int k=0; k<count; k++)
+    for (int b=0; b<2; b++) {
+      auto mask = (b == 0) ? Metadata::kNodeRigid1 : Metadata::kNodeRigid2;
+      rigid_offsets_.push_back(rigid_nodes_.size());
+      for (int i=replica_offsets_[k]; i<replica_offsets_[k+1]; i++)
+        if (node_flags_[i] & mask) {
+          rigid_nodes_.push_back(i);
+          rigid_bodies_.push_back(2*k + b);
+        }
+    }
+  rigid_offsets_.push_back(rigid_nodes_.size());
+  for (auto view : {&rigid_nodes_, &rigid_bodies_, &rigid_offsets_}) {
+    view->modify_host();
+    view->sync_device();
+  }
+
+  Kokkos::realloc(__workspace.gradients, csr_curvature_.entries());
+  Kokkos::realloc(__workspace.observables, nodes);
+  Kokkos::realloc(__workspace.replica_observables, count);
+  Kokkos::realloc(__workspace.bodies, 2*count);
+  __workspace.rigid_valid = false;
+  __time_step = replica(0).__time_step;
+  update_parameters();
+}
+
+void ModelEnsemble::update_parameters() {
+  replica_parameters_.init(replicas());
+  for (int k=0; k<replicas(); k++) {
+    auto& r = replica(k);
+    auto& p = replica_parameters_[k];
+    p.energy = r.energy_parameters();
+    p.step_length = r.step_length_;
+    p.mass = r.mass_;
+    p.damp_coeff = r.damp_coeff_;
+    p.temperature = r.temperature_;
+  }
+  replica_parameters_.modify_host();
+  replica_parameters_.sync_device();
+}
+
+void ModelEnsemble::update() {
+  bool thermo = thermo_every_ > 0 && __time_step % thermo_every_ == 0;
+  replica(__policy_replica).with_policy([&](auto policy) {
+    __update_velocities<decltype(policy)>(thermo);
+  });
+  __update_rigid();
+  node_velocities_.modify<MemorySpace>();
+  node_positions_.modify<MemorySpace>();
+  if (thermo)
+    __reduce_thermo();
+  __time_step++;
+}
+
+template <typename Policy>
+void ModelEnsemble::__update_velocities(bool thermo) {
+  auto positions = node_positions_;
+  auto velocities = node_velocities_;
+  auto flags = node_flags_;
+  auto owners = node_replicas_;
+  auto parameters = replica_parameters_;
+  auto csr_bonds1 = csr_bonds1_, csr_bonds2 = csr_bonds2_, csr_curvature = csr_curvature_;
+  auto csr_force_bonds1 = csr_force_bonds1_, csr_force_bonds2 = csr_force_bonds2_;
+  auto reverse = csr_curvature_reverse_;
+  auto gradients = __workspace.gradients;
+  auto observables = __workspace.observables;
+  auto pool = rand_pool_;
+  bool noise = false;
+  for (int k=0; k<replicas(); k++)
+    noise = noise || replica_parameters_[k].temperature != 0;
+
+  // forces of bonds and gradients of curvature, by parameters of the node's replica
+  Kokkos::parallel_for(node_positions_.size(), KOKKOS_LAMBDA(const int i) {
+    ReplicaEnergy para = {parameters(owners(i)).energy};
+    double energy[3] = {0, 0, 0};
+    if constexpr (Policy::kCurvature) {
+      auto others = ModelSystem::__relative_positions(positions, i, csr_curvature(i));
+      ModelSystem::__curvature_gradients(para, others, flags(i) & Metadata::kNodeNearRigid,
+          gradients, csr_curvature.offset(i));
+      if (thermo)
+        energy[2] = para.curvature_energy(others);
+    }
+
+    // energies count every bond once (half from each node), rigid ones included
+    if (thermo) {
+      ModelSystem::__bond_energies<Policy>(para, positions, i, csr_bonds1(i), csr_bonds2(i),
+          energy[0], energy[1]);
+      for (int d=0; d<3; d++)
+        observables(i, d) = energy[d];
+    }
+
+    velocities(i) = ModelSystem::__bond_forces<Policy>(para, positions, i,
+        csr_force_bonds1(i), csr_force_bonds2(i));
+  });
+
+  // gather gradients of curvature, then interior nodes move by their replica's step
+  Kokkos::parallel_for(node_positions_.size(), KOKKOS_LAMBDA(const int i) {
+    bool rigid = flags(i) & Metadata::kNodeRigid;
+    const auto& p = parameters(owners(i));
+    CoreMath::Vector reduced;
+    if constexpr (Policy::kCurvature)
+      reduced = ModelSystem::__gather_curvature(gradients, reverse, csr_curvature.offset(i),
+          csr_curvature.offset(i + 1));
+
+    if (thermo)
+      observables(i, 3) = rigid ? 0 : CoreMath::mod(velocities(i) + reduced);
+    if (noise && p.temperature != 0 && !rigid)
+      reduced += pool.gen_vector(Kokkos::sqrt(2*p.damp_coeff*p.temperature*K_B/p.mass), i);
+    velocities(i) = (velocities(i) + reduced) / p.damp_coeff;
+    if (thermo)
+      observables(i, 4) = rigid ? 0 : velocities(i) * velocities(i);
+    if (!rigid)
+      positions(i) += velocities(i) * p.step_length;
+  });
+  if (noise)
+    rand_pool_.advance();
+}
+
+void ModelEnsemble::__update_rigid() {
+  // centers and second moments are recomputed as often as ModelSystem does
+  bool refresh = !__workspace.rigid_valid || __time_step % ModelSystem::kRigidRefresh == 0;
+  auto positions = node_positions_;
+  auto velocities = node_velocities_;
+  auto parameters = replica_parameters_;
+  auto nodes = rigid_nodes_, owners = rigid_bodies_, offsets = rigid_offsets_;
+  auto bodies = __workspace.bodies;
+
+  // total force and moment of a body, and its motion
+  Kokkos::parallel_for(bodies.extent(0), KOKKOS_LAMBDA(const int b) {
+    auto& body = bodies(b);
+    const auto& p = parameters(b / 2);
+    int begin = offsets(b), end = offsets(b + 1);
+    if (refresh) {
+      CoreMath::Vector sum;
+      for (int k=begin; k<end; k++)
+        sum += positions(nodes(k));
+      body.center = sum / (end - begin);
+      body.diagonal = body.off_diagonal = CoreMath::Vector();
+      for (int k=begin; k<end; k++)
+        ModelSystem::__add_second_moment(positions(nodes(k)) - body.center, body.diagonal,
+            body.off_diagonal);
+    } else {
+      body.center = body.next_center;
+    }
+
+    body.force = body.moment = CoreMath::Vector();
+    for (int k=begin; k<end; k++) {
+      int i = nodes(k);
+      auto force = p.damp_coeff * velocities(i);
+      body.force += force;
+      body.moment += CoreMath::cross(positions(i) - body.center, force);
+    }
+    body.tensor = ModelSystem::__rigid_tensor(end - begin, body.moment, body.diagonal);
+    body.next_center = body.center;
+    ModelSystem::__move_rigid(body.next_center, body.diagonal, body.off_diagonal, body.force,
+        body.tensor, p.step_length, p.damp_coeff);
+  });
+
+  // velocities of rigid nodes become the motion of their bodies, then they move
+  Kokkos::parallel_for(rigid_nodes_.size(), KOKKOS_LAMBDA(const int k) {
+    int i = nodes(k);
+    const auto& body = bodies(owners(k));
+    const auto& p = parameters(owners(k) / 2);
+    velocities(i) = ModelSystem::__rigid_velocity(body.force, body.tensor,
+        positions(i) - body.center, p.damp_coeff);
+    positions(i) += velocities(i) * p.step_length;
+  });
+  __workspace.rigid_valid = true;
+}
+
+void ModelEnsemble::__reduce_thermo() {
+  auto observables = __workspace.observables;
+  auto sums = __workspace.replica_observables;
+  auto offsets = replica_offsets_;
+  Kokkos::parallel_for(replicas(), KOKKOS_LAMBDA(const int k) {
+    double sum[5] = {0, 0, 0, 0, 0};
+    for (int i=offsets(k); i<offsets(k + 1); i++) {
+      for (int d=0; d<3; d++)
+        sum[d] += observables(i, d);
+      sum[3] = Kokkos::fmax(sum[3], observables(i, 3));
+      sum[4] += observables(i, 4);
+    }
+    for (int d=0; d<5; d++)
+      sums(k, d) = sum[d];
+  });
+  auto host = Kokkos::create_mirror_view_and_copy(Kokkos::HostSpace(), sums);
+  auto bodies = Kokkos::create_mirror_view_and_copy(Kokkos::HostSpace(), __workspace.bodies);
+
+  // thermo is kept and printed by every replica
+  for (int k=0; k<replicas(); k++) {
+    auto& r = replica(k);
+    auto& thermo = r.__thermo;
+    int interior = replica_offsets_[k+1] - replica_offsets_[k] - r.node_if_rigid1_count_ -
+        r.node_if_rigid2_count_;
+    thermo.time_step = __time_step;
+    thermo.step_length = r.step_length_;
+    thermo.bond1_energy = host(k, 0);
+    thermo.bond2_energy = host(k, 1);
+    thermo.curvature_energy = host(k, 2);
+    thermo.max_force = host(k, 3);
+    thermo.rms_velocity = Kokkos::sqrt(host(k, 4) / interior);
+    thermo.force1 = bodies(2*k).force;
+    thermo.moment1 = bodies(2*k).moment;
+    thermo.force2 = bodies(2*k + 1).force;
+    thermo.moment2 = bodies(2*k + 1).moment;
+    std::printf("replica %i ", k);
+    r.__print_thermo();
+  }
+}
+
+void ModelEnsemble::unpack(int k) {
+  auto& r = replica(k);
+  int offset = replica_offsets_[k], count = replica_offsets_[k+1] - offset;
+  for (auto pair : {std::make_pair(&r.node_positions_, &node_positions_),
+      std::make_pair(&r.node_velocities_, &node_velocities_)}) {
+    pair.second->sync<MemorySpace>();
+    // every row of the replica is overwritten on device
+    pair.first->clear_sync_state();
+    auto to = *pair.first, from = *pair.second;
+    Kokkos::parallel_for(count, KOKKOS_LAMBDA(const int i) {
+      to(i) = from(offset + i);
+    });
+    pair.first->modify<MemorySpace>();
+  }
+  r.__time_step = __time_step;
+  // bodies and backups of the replica itself belong to an older step
+  r.__workspace.rigid_time_step = -1;
+  r.__workspace.backup_time_step = -1;
+}
@@ -0,0 +1,132 @@
+/**
+ * @file ensemble.h
+ * @author Bohan Cao (2110313@mail.nankai.edu.cn)
+ * @brief Replicas of molecular system advanced together
+ * @version 0.0.1
+ * @date 2023-03-24
+ *
+ * @copyright Copyright (c) 2023
+ */
+#ifndef QUADRATUBE_MODEL_ENSEMBLE_H_
+#define QUADRATUBE_MODEL_ENSEMBLE_H_
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "metadata.h"
+#include "core/math.h"
+#include "model/system.h"
+
+/**
+ * @class ModelEnsemble
+ * @brief Independent replicas of ModelSystem advanced by the same kernels
+ * @details A tube of a thousand nodes can't fill a device, and every update launches
+ *     several kernels for it. Replicas are packed into flattened views instead: nodes
+ *     of replica k are [replica_offsets_[k], replica_offsets_[k+1]), adjacents are
+ *     shifted by the offset, and each replica keeps its own energy parameters, step
+ *     length, damping, mass and temperature. A step of all replicas takes four kernel
+ *     launches (forces, gather and move, rigid bodies, rigid nodes).
+ *
+ *     Replicas are built (init or load) and configured like a system, then pack()
+ *     copies them in. Update of an ensemble is a fused step with analytic pair
+ *     potentials, kBondGather and kCurvatureGather, without adaptive step, and pack()
+ *     aborts on replicas configured otherwise. Forces and rigid bodies are evaluated
+ *     by the same per-node bodies as ModelSystem. Noise is drawn from rand_pool_ of
+ *     the ensemble. unpack() copies positions, velocities and time step back into a
+ *     replica, for dump, store or modifier.
+ */
+class ModelEnsemble {
+  public:
+    using MemorySpace = ModelSystem::MemorySpace;
+    using HostMirrorSpace = ModelSystem::HostMirrorSpace;
+
+    explicit ModelEnsemble(int replicas);
+
+    /// @brief replicas, build and configure them before pack()
+    inline int replicas() const { return __replicas.size(); }
+    inline ModelSystem& replica(int k) { return *__replicas[k]; }
+    inline const ModelSystem& replica(int k) const { return *__replicas[k]; }
+
+    /// @brief copy every replica into flattened views and parameters, on host. Call
+    ///     after replicas are built or changed outside the ensemble. Replicas continue
+    ///     from the time step of the first one.
+    void pack();
+    /// @brief copy parameters of replicas again, without their nodes
+    void update_parameters();
+    void update();
+    /// @brief copy nodes and time step of replica k back, thermo of replica k is kept
+    ///     by the replica itself (ModelSystem::thermo())
+    void unpack(int k);
+    inline void dump(int k, std::string file_name, Metadata::DumpType dump_type) {
+      unpack(k);
+      replica(k).dump(file_name, dump_type);
+    }
+
+    /// @brief reduce thermo of every replica every thermo_every_ steps (0 for never),
+    ///     printed by each replica with its own thermo_type_
+    int thermo_every_ = 0;
+
+    /// @brief Random number pool, streams are flattened node indices
+    CoreMath::Pool rand_pool_;
+
+    /// @brief everything a kernel needs of a replica
+    struct ReplicaParameters {
+      Metadata::EnergyParameters energy;
+      double step_length, mass, damp_coeff, temperature;
+    };
+
+  // Flattened from replicas by pack()
+  public:
+    CoreMath::VectorView node_positions_;
+    CoreMath::VectorView node_velocities_;
+    CoreMath::View<Metadata::NodeFlag> node_flags_;
+    /// @brief replica of every node, and first node of every replica (and the end)
+    CoreMath::View<int> node_replicas_;
+    CoreMath::View<int> replica_offsets_;
+    CoreMath::View<ReplicaParameters> replica_parameters_;
+
+    /// @brief the same as those of ModelSystem, with flattened indices
+    CoreMath::Csr csr_bonds1_, csr_bonds2_, csr_curvature_;
+    CoreMath::View<int> csr_curvature_reverse_;
+    CoreMath::Csr csr_force_bonds1_, csr_force_bonds2_;
+    /// @brief rigid nodes grouped by body, bodies 2k and 2k+1 are the ends of replica
+    ///     k, nodes of body b are [rigid_offsets_[b], rigid_offsets_[b+1])
+    CoreMath::View<int> rigid_nodes_, rigid_bodies_, rigid_offsets_;
+
+  private:
+    std::vector<std::unique_ptr<ModelSystem>> __replicas;
+    int __time_step = 0;
+    /// @brief replica whose lattice has every term of all replicas, its EnergyPolicy
+    ///     is used for all of them
+    int __policy_replica = 0;
+
+    /// @brief forces of bonds and gradients of curvature, then gathered and moved
+    template <typename Policy>
+    void __update_velocities(bool thermo);
+    /// @brief the same solver as ModelSystem::__update_rigid, a body per thread
+    void __update_rigid();
+    /// @brief sum observables of nodes replica by replica into their thermo
+    void __reduce_thermo();
+
+    /// @brief motion of a rigid end, center is the one nodes are moved about in this
+    ///     step, next_center the one of the next step
+    struct RigidBody {
+      CoreMath::Vector center, next_center, diagonal, off_diagonal;
+      CoreMath::Vector force, moment, tensor;
+    };
+
+    /// @brief Temporaries of update, sized by pack()
+    struct Workspace {
+      /// @brief gradients of curvature, one per entry of csr_curvature_
+      Kokkos::View<CoreMath::RealVector*> gradients;
+      /// @brief bond1, bond2, curvature energy, |force| and velocity^2 of nodes on
+      ///     thermo steps, and their sums (max of |force|) of replicas
+      Kokkos::View<double*[5]> observables, replica_observables;
+      Kokkos::View<RigidBody*> bodies;
+      /// @brief whether centers and second moments of bodies belong to this step
+      bool rigid_valid = false;
+    } __workspace;
+}; // class ModelEnsemble
+
+#endif // QUADRATUBE_MODEL_ENSEMBLE_H_
@@ -28,21 +28,37 @@ typedef struct {
   int climb;   ///< steps of climb
   int bn;      ///< begin position
   double rest_len;  ///< rest length
+  bool reorder;     ///< renumber nodes for locality after construction
+  Metadata::Lattice lattice;  ///< lattice of the tube, kTriangular if omitted
 } Parameters;
 
 class Initializer {
   public:
     inline Initializer(ModelSystem& system): __system(system) {}
-    void init(Parameters init_parameter);
+    /// @brief build the tube of init_parameter.lattice, update of system follows it
+    /// @details Only triangular tubes can be built. init_quadrangular stops after
+    ///     bonds and glides, without flags, curvature adjacents or workspace, so a
+    ///     quadrangular tube aborts here instead of crashing in update.
+    inline void init(Parameters init_parameter) {
+      if (init_parameter.lattice != Metadata::kTriangular)
+        Kokkos::abort("Initializer: quadrangular tubes aren't supported yet");
+      __system.lattice_ = init_parameter.lattice;
+      init_triangular(init_parameter);
+    }
 
   private:
+    /// @brief constructions of each lattice, in initializer3.cpp and initializer4.cpp,
+    ///     the quadrangular one is unfinished and not called by init
+    void init_triangular(Parameters init_parameter);
+    void init_quadrangular(Parameters init_parameter);
+
     /// @brief flags of function
     enum ObjectType {
       Bond1, Bond2, Curvatrue
     };
 
     /// @brief to surrport reuse of functions
-    inline CoreMath::View<CoreMath::Array<int>>& node_adjacents(ObjectType tp) {
+    inline CoreMath::HostView<CoreMath::Array<int>>& node_adjacents(ObjectType tp) {
       if (tp == Bond1)
         return __system.node_adjacents_bonds1_;
       if (tp == Bond2)
@@ -94,16 +110,31 @@ class Initializer {
         bond_relations(tp).remove(bond);
     }
 
-    /// @brief remove node node and related bonds
+    /// @brief remove node node and related bonds, triangular lattice only
     void remove(int node);
     /// @brief bond, n1 is insert position of bond[0], n2 is insert position of bond[1]
     inline void insert(ObjectType tp, CoreMath::Pair<int> bond, int* n1, int* n2) {
+      check_room(tp, bond[0]);
+      check_room(tp, bond[1]);
       if (tp != Curvatrue)
         bond_relations(tp).push_back(bond);
       node_adjacents(tp)[bond[0]].insert(n1, bond[1]);
       node_adjacents(tp)[bond[1]].insert(n2, bond[0]);
     }
-    
+
+    /// @brief add other to the end of adjacents of node
+    inline void push_back(ObjectType tp, int node, int other) {
+      check_room(tp, node);
+      node_adjacents(tp)[node].push_back(other);
+    }
+    /// @brief adjacents have fixed capacity and Array checks it only in debug builds
+    ///     of Kokkos, so a lattice or defect overflowing it aborts here
+    inline void check_room(ObjectType tp, int node) {
+      if (node_adjacents(tp)[node].size() >= CoreMath::Array<int>::capacity())
+        Kokkos::abort(("initializer: node " + std::to_string(node) + " has more than " +
+            std::to_string(CoreMath::Array<int>::capacity()) + " adjacents").c_str());
+    }
+
     /// @brief add p to last of node_positions_, return it's position
     inline int insert(CoreMath::Vector p) {
       __system.node_positions_.push_back(p);
@@ -14,16 +14,6 @@
 
 namespace ModelInitializer {
 
-int Initializer::dual(ObjectType tp, int ck, int a, int b) {
-  int il = -1, ir = -1;
-  for (auto i : __system.node_adjacents_bonds1_[b]) {
-    auto j = __system.node_adjacents_bonds1_[a].find(i);
-    if (j != __system.node_adjacents_bonds1_[a].end())
-      ((il == -1) ? il : ir) = *j;
-  }
-  return (il == ck) ? ir : il;
-}
-
 void Initializer::remove(int node) {
   __system.node_positions_[node] = __system.node_positions_[__system.node_positions_.size()-1];
   __system.node_positions_.pop_back();
@@ -48,9 +38,9 @@ void Initializer::remove(int node) {
  * 3-4. node_adjacents_bonds1_ & node_adjacents_curvature_: 
  *   keep the same in memory space (won't be used by host)
  * 5. node_adjacents_bonds2_: just need to initialize on memory space
- * 6-7. node_if_emphasis_ & node_if_emphasis_count_: use begin and end
- * 8-11. node_if_rigid1_ & node_if_next_to_rigid1_ & node_if_rigid2_ & 
- *   node_if_next_to_rigid2_: check at the end
+ * 6-7. node_flags_ (emphasis) & node_if_emphasis_count_: use begin and end
+ * 8-11. node_flags_ (rigid1, next_to_rigid1, rigid2, next_to_rigid2): check
+ *   at the end
  * 12-15. node_if_rigid1_count_ & node_if_next_to_rigid1_count_ & node_if_rigid2_count_
  *   & node_if_next_to_rigid2_count_: calculate by structures before
  * 16. bond_relations1_: used by host, don't need to sync
@@ -60,7 +50,7 @@ void Initializer::remove(int node) {
  * 
  * @param init_para
  */
-void Initializer::init(Parameters init_para) {
+void Initializer::init_triangular(Parameters init_para) {
   // this parameters struct is used by other 'small' functions
   __para = init_para;
   // allocate size of system
@@ -112,14 +102,14 @@ void Initializer::init(Parameters init_para) {
         if (Kokkos::abs(__system.node_positions_[flat(i, j)][2] -
             __system.node_positions_[a][2]) < 2*init_para.rest_len) {
           __system.bond_relations1_.push_back({flat(i, j), a});
-          __system.node_adjacents_bonds1_[flat(i, j)].push_back(a);
+          push_back(Bond1, flat(i, j), a);
         }
       };
       // don't push_back bond again because it has been counted
       auto near_then_push = [=](int a) {
         if (Kokkos::abs(__system.node_positions_[flat(i, j)][2] -
             __system.node_positions_[a][2]) < 2*init_para.rest_len)
-          __system.node_adjacents_bonds1_[flat(i, j)].push_back(a);
+          push_back(Bond1, flat(i, j), a);
       };
       // CHANGE 3. CHANGE 16.
       near_then_push_all(flat(i+1, j));
@@ -238,91 +228,65 @@ void Initializer::init(Parameters init_para) {
 
   __system.node_positions_.modify_host();
   __system.node_positions_.sync_device();
-  __system.node_adjacents_bonds1_.modify_host();
-  __system.node_adjacents_bonds1_.sync_device();
 
-  __system.node_if_emphasis_.init(__system.node_positions_.size(), nodes_number);
+  __system.node_flags_.init(__system.node_positions_.size(), nodes_number);
   __system.node_if_emphasis_count_ = 4;
   for (int i=0; i<__system.node_positions_.size(); i++)
     if (i == dislocations[0] || i == dislocations[1] || 
         i == dislocations[2] || i == dislocations[3])
-      __system.node_if_emphasis_[i] = true;
-  
-  __system.node_if_emphasis_.modify_host();
-  __system.node_if_emphasis_.sync_device();
+      __system.node_flags_[i] = Metadata::kNodeEmphasis;
 
 // * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
 //   STEP 8. set up boundary nodes for update
 // * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
 
-  __system.node_if_rigid1_.init(__system.node_positions_.size());
-  __system.node_if_rigid2_.init(__system.node_positions_.size());
-
   // FINISH 8. FINISH 10. FINISH 12. FINISH 14. boundary count
-  Kokkos::parallel_reduce(__system.node_positions_.size(), 
-    KOKKOS_CLASS_LAMBDA(const int i, int& inner1, int& inner2){
+  // adjacents are only on host, so are boundaries
+  __system.node_if_rigid1_count_ = __system.node_if_rigid2_count_ = 0;
+  for (int i=0; i<__system.node_positions_.size(); i++) {
     // if it's a boundary node
-    if (__system.node_adjacents_bonds1_(i).size() != 6 && !__system.node_if_emphasis_(i)) {
+    auto& flag = __system.node_flags_[i];
+    flag &= ~Metadata::kNodeRigid;
+    if (__system.node_adjacents_bonds1_[i].size() != 6 && !(flag & Metadata::kNodeEmphasis)) {
       // if it's next to bottom
-      if (__system.node_positions_(i)[2] < 5*init_para.rest_len) {
-        __system.node_if_rigid1_(i) = true;
-        inner1++;
-        __system.node_if_rigid2_(i) = false;
+      if (__system.node_positions_[i][2] < 5*init_para.rest_len) {
+        flag |= Metadata::kNodeRigid1;
+        __system.node_if_rigid1_count_++;
       } else {
-        __system.node_if_rigid2_(i) = true;
-        inner2++;
-        __system.node_if_rigid1_(i) = false;
+        flag |= Metadata::kNodeRigid2;
+        __system.node_if_rigid2_count_++;
       }
-    } else {
-      __system.node_if_rigid1_(i) = false;
-      __system.node_if_rigid2_(i) = false;
     }
-  }, __system.node_if_rigid1_count_, __system.node_if_rigid2_count_);
-
-  // for consistent with function store()
-  __system.node_if_rigid1_.modify_device();
-  __system.node_if_rigid1_.sync_host();
-  __system.node_if_rigid2_.modify_device();
-  __system.node_if_rigid2_.sync_host();
+  }
 
 // * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
 //   STEP 9. set up nodes for boundary for update
 // * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
 
-  __system.node_if_next_to_rigid1_.init(__system.node_positions_.size());
-  __system.node_if_next_to_rigid2_.init(__system.node_positions_.size());
-
   // FINISH 9. FINISH 11. FINISH 13. FNISH 15. check next to boundary
-  Kokkos::parallel_reduce(__system.node_positions_.size(), 
-    KOKKOS_CLASS_LAMBDA(const int i, int& inner1, int& inner2){
+  __system.node_if_next_to_rigid1_count_ = __system.node_if_next_to_rigid2_count_ = 0;
+  for (int i=0; i<__system.node_positions_.size(); i++) {
+    auto& flag = __system.node_flags_[i];
+    flag &= ~(Metadata::kNodeNextToRigid1 | Metadata::kNodeNextToRigid2);
     // if it's not a boundary node
-    if (!__system.node_if_rigid1_(i) && !__system.node_if_rigid2_(i)) {
-      for (auto j : __system.node_adjacents_bonds1_(i)) {
+    if (!(flag & Metadata::kNodeRigid)) {
+      for (auto j : __system.node_adjacents_bonds1_[i]) {
         // if it's next to boundary node
-        if (__system.node_if_rigid1_(i)) {
-          __system.node_if_next_to_rigid1_(i) = true;
-          inner1++;
-          __system.node_if_next_to_rigid2_(i) = false;
-          // skip additional assignment (equal to break; and continue; immediately)
-          goto ContinueLoop;
-        } else if (__system.node_if_rigid2_(i)) {
-          __system.node_if_next_to_rigid2_(i) = true;
-          inner2++;
-          __system.node_if_next_to_rigid1_(i) = false;
-          goto ContinueLoop;
+        if (__system.node_flags_[j] & Metadata::kNodeRigid1) {
+          flag |= Metadata::kNodeNextToRigid1;
+          __system.node_if_next_to_rigid1_count_++;
+          break;
+        } else if (__system.node_flags_[j] & Metadata::kNodeRigid2) {
+          flag |= Metadata::kNodeNextToRigid2;
+          __system.node_if_next_to_rigid2_count_++;
+          break;
         }
       }
-      // if it's not next to boundary node
-      __system.node_if_next_to_rigid1_(i) = false;
-      __system.node_if_next_to_rigid2_(i) = false;
-      ContinueLoop: ;
     }
-  }, __system.node_if_next_to_rigid1_count_, __system.node_if_next_to_rigid2_count_);
+  }
 
-  __system.node_if_next_to_rigid1_.modify_device();
-  __system.node_if_next_to_rigid1_.sync_host();
-  __system.node_if_next_to_rigid2_.modify_device();
-  __system.node_if_next_to_rigid2_.sync_host();
+  __system.node_flags_.modify_host();
+  __system.node_flags_.sync_device();
 
 // * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
 //   STEP 10. set redundant objects for model3
@@ -332,20 +296,19 @@ void Initializer::init(Parameters init_para) {
   __system.node_adjacents_bonds2_.init(__system.node_positions_.size());
   for (int i=0; i<__system.node_positions_.size(); i++)
     __system.node_adjacents_bonds2_[i] = CoreMath::Array<int>();
-  __system.node_adjacents_bonds2_.modify_host();
-  __system.node_adjacents_bonds2_.sync_device();
 
-  // FINISH 4. `node_adjacents_curvature_` must keep consistent with `node_adjacents_bonds1_`, but 
-  //    won't be used by host. So just copy MemorySpace.
+  // FINISH 4. `node_adjacents_curvature_` must keep consistent with `node_adjacents_bonds1_`.
   __system.node_adjacents_curvature_.init(__system.node_positions_.size());
-  Kokkos::deep_copy(__system.node_adjacents_curvature_.view_device(),
-      __system.node_adjacents_bonds1_.view_device());
-  __system.node_adjacents_bonds1_.modify_device();
-  __system.node_adjacents_bonds1_.sync_host();
+  for (int i=0; i<__system.node_positions_.size(); i++)
+    __system.node_adjacents_curvature_[i] = __system.node_adjacents_bonds1_[i];
   // FINISH 17. `bond_relations2_` won't be used at all.
 
   // FINISH 2. set velocities
   __system.node_velocities_.init(__system.node_positions_.size());
+  // neighbours are scattered by numbering of lattice and climbs, renumber them
+  if (init_para.reorder)
+    __system.reorder();
+  __system.resize_workspace();
   __system.update(true);
 }
 
@@ -1,7 +1,8 @@
 /**
  * @file initializer4.cpp
  * @author Bohan Cao (2110313@mail.nankai.edu.cn)
- * @brief 
+ * @brief Construction of the quadrangular tube, unfinished: nodes, bonds and glides
+ *     only, so Initializer::init doesn't call it
  * @version 0.0.1
  * @date 2023-03-14
  * 
@@ -22,9 +23,7 @@ int Initializer::dual(ObjectType tp, int ck, int a, int b) {
   return (il == ck) ? ir : il;
 }
 
-void Initializer::remove(int node) {}
-
-void Initializer::init(Parameters init_para) {
+void Initializer::init_quadrangular(Parameters init_para) {
   // this parameters struct is used by other 'small' functions
   __para = init_para;
   // allocate size of system
@@ -78,14 +77,14 @@ void Initializer::init(Parameters init_para) {
         if (Kokkos::abs(__system.node_positions_[flat(i, j)][2] -
             __system.node_positions_[a][2]) < 2*init_para.rest_len) {
           bond_relations(tp).push_back({flat(i, j), a});
-          node_adjacents(tp)[flat(i, j)].push_back(a);
+          push_back(tp, flat(i, j), a);
         }
       };
       // don't push_back bond again because it has been counted
       auto near_then_push = [=](ObjectType tp, int a) {
         if (Kokkos::abs(__system.node_positions_[flat(i, j)][2] -
             __system.node_positions_[a][2]) < 2*init_para.rest_len)
-          node_adjacents(tp)[flat(i, j)].push_back(a);
+          push_back(tp, flat(i, j), a);
       };
       // CHANGE 3. CHANGE 16.
       near_then_push_all(Bond1, flat(i+1, j));
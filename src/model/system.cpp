@@ -9,12 +9,26 @@
  */
 #include "model/system.h"
 
+#include <fcntl.h>
 #include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <utility>
+#include <vector>
 
 #include <Kokkos_Core.hpp>
 
 #include "core/math.h"
 #include "metadata.h"
+#include "model/decomposition.h"
+#include "utils/trajectory.h"
+#include "utils/writer.h"
 
 namespace {
 
@@ -28,230 +42,1496 @@ const char __dump_file_header[] =
     "ITEM: TIMESTEP\n%i\nITEM: NUMBER OF ATOMS\n%li\nITEM: BOX BOUNDS ss ss ss\n"
     "%.8f\t%.8f\n%.8f\t%.8f\n%.8f\t%.8f\nITEM: ATOMS id type x y z";
 
-} // namespace
+/// @brief checkpoint layout: header, section table, then 64 bytes aligned data
+///     blocks of every view. Change version when layout changes.
+const char __checkpoint_magic[8] = {'Q', 'T', 'U', 'B', 'E', 'C', 'K', 'P'};
+const uint32_t __checkpoint_version = 7;
+const uint32_t __checkpoint_endian = 0x01020304;
 
-void ModelSystem::dump(std::string file_name, Metadata::DumpType dump_type) {
-  // others won't be changed by update
-  node_positions_.sync<HostMirrorSpace>();  
-  node_velocities_.sync<HostMirrorSpace>();
+struct CheckpointHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t endian;
+  int32_t time_step;
+  /// emphasis, rigid1, next_to_rigid1, rigid2, next_to_rigid2
+  int32_t counts[5];
+  uint64_t rand_seed;
+  uint64_t rand_counter;
+  double parameters[Metadata::EnergyMetaData::kParameterNumber];
+  double step_length;
+  double mass;
+  double damp_coeff;
+  double temperature;
+  /// Metadata::Lattice of the tube
+  int32_t lattice;
+  /// centers, diagonal and off diagonal second moments of rigid bodies kept by
+  /// update, so that a restart continues with the same rounding. Valid if
+  /// rigid_time_step equals time_step
+  int32_t rigid_time_step;
+  double rigid[6][3];
+  /// state of adaptive step: time, counts, noise_step (0 before adaptation starts)
+  /// and the time step backups lead to. Backups and last forces are the sections
+  /// after views, empty unless backup_time_step equals time_step
+  double time;
+  double noise_step;
+  int32_t accepted, rejected;
+  int32_t backup_time_step;
+  uint64_t section_number;
+};
+
+struct CheckpointSection {
+  char name[32];
+  uint64_t element_size;
+  uint64_t size;
+  uint64_t capacity;
+  uint64_t offset;
+};
+
+inline uint64_t checkpoint_align(uint64_t offset) { return (offset + 63) / 64 * 64; }
+
+/// @brief every view is stored as an array of elements, vectors are always (x, y, z)
+///     of each node whatever NodeLayout is, so that checkpoints are portable
+template <typename T, typename S>
+inline size_t checkpoint_element_size(const CoreMath::View<T, S>&) { return sizeof(T); }
+inline size_t checkpoint_element_size(const CoreMath::VectorView&) {
+  return sizeof(CoreMath::Vector);
+}
+
+template <typename T, typename S>
+bool checkpoint_write(FILE* file, const CoreMath::View<T, S>& view) {
+  return std::fwrite(view.h_view.data(), sizeof(T), view.size(), file) == view.size();
+}
+bool checkpoint_write(FILE* file, const CoreMath::VectorView& view) {
+  std::vector<CoreMath::Vector> buffer(view.size());
+  for (int i=0; i<view.size(); i++)
+    buffer[i] = view[i];
+  return std::fwrite(buffer.data(), sizeof(CoreMath::Vector), buffer.size(), file) ==
+      buffer.size();
+}
+
+template <typename T, typename S>
+void checkpoint_read(CoreMath::View<T, S>& view, const char* data) {
+  std::memcpy(view.h_view.data(), data, view.size()*sizeof(T));
+}
+void checkpoint_read(CoreMath::VectorView& view, const char* data) {
+  for (int i=0; i<view.size(); i++) {
+    CoreMath::Vector p;
+    std::memcpy(&p, data + i*sizeof(CoreMath::Vector), sizeof(CoreMath::Vector));
+    view[i] = p;
+  }
+}
+
+/// @brief arrays of adjacents must fit their capacity, other elements are taken as is
+template <typename T, typename S>
+bool checkpoint_valid(const CoreMath::View<T, S>&, const char*, size_t) { return true; }
+template <typename T, size_t N, typename S>
+bool checkpoint_valid(const CoreMath::View<CoreMath::Array<T, N>, S>&, const char* data,
+    size_t size) {
+  for (size_t i=0; i<size; i++) {
+    CoreMath::Array<T, N> p;
+    std::memcpy(&p, data + i*sizeof(p), sizeof(p));
+    if (p.size() > N)
+      return false;
+  }
+  return true;
+}
+bool checkpoint_valid(const CoreMath::VectorView&, const char*, size_t) { return true; }
+
+/// @brief device arrays of vectors in workspace, in the same form as VectorView
+void checkpoint_vectors(const CoreMath::VectorView::t_dev& view,
+    std::vector<CoreMath::Vector>& buffer) {
+  auto host = Kokkos::create_mirror_view_and_copy(Kokkos::HostSpace(), view);
+  for (int i=0; i<buffer.size(); i++)
+    buffer[i] = CoreMath::Vector(host(i, 0), host(i, 1), host(i, 2));
+}
+void checkpoint_vectors(const Kokkos::View<CoreMath::Vector*>& view,
+    std::vector<CoreMath::Vector>& buffer) {
+  auto host = Kokkos::create_mirror_view_and_copy(Kokkos::HostSpace(), view);
+  for (int i=0; i<buffer.size(); i++)
+    buffer[i] = host(i);
+}
+void checkpoint_read(CoreMath::VectorView::t_dev& view, const char* data, size_t size) {
+  auto host = Kokkos::create_mirror_view(view);
+  for (int i=0; i<size; i++)
+    for (int d=0; d<3; d++)
+      std::memcpy(&host(i, d), data + i*sizeof(CoreMath::Vector) + d*sizeof(double),
+          sizeof(double));
+  Kokkos::deep_copy(view, host);
+}
+void checkpoint_read(Kokkos::View<CoreMath::Vector*>& view, const char* data, size_t size) {
+  auto host = Kokkos::create_mirror_view(view);
+  for (int i=0; i<size; i++)
+    std::memcpy(&host(i), data + i*sizeof(CoreMath::Vector), sizeof(CoreMath::Vector));
+  Kokkos::deep_copy(view, host);
+}
+
+/// @brief sections of adaptive step after views
+const char* __checkpoint_backups[3] = {"backup_positions", "backup_velocities",
+    "last_forces"};
+
+/// @brief trajectory takes arrays of Vector in original order, the same memory as
+///     LayoutRight if nodes are never reordered
+const CoreMath::Vector* frame_vectors(const UtilsWriter::Frame::View& view, size_t size,
+    const CoreMath::View<int>& ids, std::vector<CoreMath::Vector>& buffer) {
+  if (std::is_same<CoreMath::NodeLayout, Kokkos::LayoutRight>::value && ids.size() == 0)
+    return reinterpret_cast<const CoreMath::Vector*>(view.data());
+  buffer.resize(size);
+  for (int i=0; i<size; i++)
+    buffer[(ids.size() == 0) ? i : ids[i]] = CoreMath::Vector(view(i, 0), view(i, 1), view(i, 2));
+  return buffer.data();
+}
+
+/// @brief host permutation of per-node views, the i-th becomes the order[i]-th
+template <typename T, typename S>
+void permute_nodes(CoreMath::View<T, S>& view, const std::vector<int>& order) {
+  std::vector<T> buffer(view.h_view.data(), view.h_view.data() + view.size());
+  for (int i=0; i<view.size(); i++)
+    view[i] = buffer[order[i]];
+  view.modify_host();
+  view.sync_device();
+}
+void permute_nodes(CoreMath::VectorView& view, const std::vector<int>& order) {
+  std::vector<CoreMath::Vector> buffer(view.size());
+  for (int i=0; i<view.size(); i++)
+    buffer[i] = view[i];
+  for (int i=0; i<view.size(); i++)
+    view[i] = buffer[order[i]];
+  view.modify_host();
+  view.sync_device();
+}
+
+
+/// @brief bonds of relations except rigid-rigid ones, sorted by colors of a greedy
+///     edge coloring, so that bonds of one color share no node
+void color_bonds(const CoreMath::View<CoreMath::Pair<int>>& relations,
+    const CoreMath::View<Metadata::NodeFlag>& flags, CoreMath::View<CoreMath::Pair<int>>& bonds,
+    CoreMath::View<int>& colors) {
+  std::vector<int> color(relations.size(), -1), count;
+  std::vector<uint64_t> used(flags.size(), 0);
+  for (int k=0; k<relations.size(); k++) {
+    int a = relations[k][0], b = relations[k][1];
+    if ((flags[a] & Metadata::kNodeRigid) && (flags[b] & Metadata::kNodeRigid))
+      continue;
+    // degrees are small, 64 colors are always enough
+    int c = 0;
+    while ((used[a] | used[b]) & (uint64_t(1) << c))
+      c++;
+    used[a] |= uint64_t(1) << c;
+    used[b] |= uint64_t(1) << c;
+    color[k] = c;
+    if (c >= count.size())
+      count.resize(c + 1, 0);
+    count[c]++;
+  }
+
+  colors.init(count.size() + 1);
+  colors[0] = 0;
+  for (int c=0; c<count.size(); c++)
+    colors[c+1] = colors[c] + count[c];
+  bonds.init(colors[count.size()]);
+  std::vector<int> next(colors.h_view.data(), colors.h_view.data() + count.size());
+  for (int k=0; k<relations.size(); k++)
+    if (color[k] >= 0)
+      bonds[next[color[k]]++] = relations[k];
+  colors.modify_host();
+  colors.sync_device();
+  bonds.modify_host();
+  bonds.sync_device();
+}
+
+/// @brief nodes with curvature forces sorted by colors of a greedy distance-2
+///     coloring, nodes of one color write disjoint nodes (themselves and adjacents)
+void color_curvature(const CoreMath::HostView<CoreMath::Array<int>>& adjacents,
+    const CoreMath::View<Metadata::NodeFlag>& flags, CoreMath::View<int>& nodes,
+    CoreMath::View<int>& colors) {
+  std::vector<int> color(adjacents.size(), -1), count, stamp;
+  for (int i=0; i<adjacents.size(); i++) {
+    if (flags[i] & Metadata::kNodeNearRigid)
+      continue;
+    // colors of nodes within distance 2 are forbidden, marked by stamp i
+    auto forbid = [&](int k) {
+      if (color[k] >= 0)
+        stamp[color[k]] = i;
+    };
+    forbid(i);
+    for (auto j : adjacents[i]) {
+      forbid(j);
+      for (auto k : adjacents[j])
+        forbid(k);
+    }
+    int c = 0;
+    while (c < stamp.size() && stamp[c] == i)
+      c++;
+    if (c == stamp.size()) {
+      stamp.push_back(-1);
+      count.push_back(0);
+    }
+    color[i] = c;
+    count[c]++;
+  }
+
+  colors.init(count.size() + 1);
+  colors[0] = 0;
+  for (int c=0; c<count.size(); c++)
+    colors[c+1] = colors[c] + count[c];
+  nodes.init(colors[count.size()]);
+  std::vector<int> next(colors.h_view.data(), colors.h_view.data() + count.size());
+  for (int i=0; i<adjacents.size(); i++)
+    if (color[i] >= 0)
+      nodes[next[color[i]]++] = i;
+  colors.modify_host();
+  colors.sync_device();
+  nodes.modify_host();
+  nodes.sync_device();
+}
+
+/// @brief nodes with curvature forces sorted by degree, in groups of at most width
+///     nodes of the same degree
+void batch_curvature(const CoreMath::HostView<CoreMath::Array<int>>& adjacents,
+    const CoreMath::View<Metadata::NodeFlag>& flags, int width, CoreMath::View<int>& nodes,
+    CoreMath::View<int>& groups) {
+  std::vector<int> order;
+  for (int i=0; i<adjacents.size(); i++)
+    if (!(flags[i] & Metadata::kNodeNearRigid))
+      order.push_back(i);
+  std::stable_sort(order.begin(), order.end(), [&](int i, int j) {
+    return adjacents[i].size() < adjacents[j].size();
+  });
+
+  nodes.init(order.size());
+  groups.init(0, order.size() + 1);
+  for (int k=0; k<order.size(); k++) {
+    nodes[k] = order[k];
+    if (k == 0 || k - groups[groups.size()-1] == width ||
+        adjacents[order[k]].size() != adjacents[order[k-1]].size())
+      groups.push_back(k);
+  }
+  groups.push_back(order.size());
+  groups.modify_host();
+  groups.sync_device();
+  nodes.modify_host();
+  nodes.sync_device();
+}
+
+/// @brief everything dump needs besides frame, won't be changed by update
+struct DumpContext {
+  Metadata::EnergyMetaData energy;
+  CoreMath::View<Metadata::NodeFlag> node_flags;
+  CoreMath::View<int> node_ids;
+  CoreMath::View<CoreMath::Pair<int>> bond_relations1;
+  CoreMath::View<CoreMath::Pair<int>> bond_relations2;
+};
+
+/// @brief write data file and append trajectory, on host
+void write_dump(const UtilsWriter::Frame& frame, const DumpContext& context) {
+  auto& file_name = frame.file_name;
+  auto dump_type = frame.dump_type;
 
   // boundary: x, y, z: [0, 30*bond1_rest_length_]
-  double boundary_max = 30*bond1_rest_length_;
+  double boundary_max = 30*context.energy.bond1_rest_length_;
 
   // total types. default type is 1, dislocations use type 2
   int atom_types = DUMP_CHECK(Metadata::kPrintDislocations, dump_type) ? 2 : 1;
   auto get_type = [=](bool in) {
     return (atom_types == 2) ? static_cast<int>(in) + 1 : 1;
   };
+  // original ids, nodes may be reordered
+  auto& ids = context.node_ids;
+  auto get_id = [&](int i) { return (ids.size() == 0) ? i : ids[i]; };
 
   // print bonds into data file, skip if file exists already.
   FILE *file = std::fopen((file_name + ".data").c_str(), "r");
   if (DUMP_CHECK(Metadata::kPrintBond, dump_type) || file == NULL) {
+    if (file != NULL)
+      std::fclose(file);
     file = std::fopen((file_name + ".data").c_str(), "w");
 
     // header, check whether bond_relations2_.size() == 0 is for model3
+    auto& bond_relations1 = context.bond_relations1;
+    auto& bond_relations2 = context.bond_relations2;
     size_t bonds = DUMP_CHECK(Metadata::kExcludeBondType2, dump_type) ?
-        bond_relations1_.size() : bond_relations1_.size() + bond_relations2_.size();
-    int bond_types = (bond_relations2_.size() == 0 ||
+        bond_relations1.size() : bond_relations1.size() + bond_relations2.size();
+    int bond_types = (bond_relations2.size() == 0 ||
         DUMP_CHECK(Metadata::kExcludeBondType2, dump_type)) ? 1 : 2;
     std::fprintf(file, __data_file_header,
-      node_positions_.size(), bonds, atom_types, bond_types,          // atom & bond number
-      0., boundary_max, 0., boundary_max, 0., boundary_max, mass_  // boundary & masses
+      frame.size, bonds, atom_types, bond_types,                      // atom & bond number
+      0., boundary_max, 0., boundary_max, 0., boundary_max, context.energy.mass_  // boundary & masses
     );
     if (atom_types == 2)
-      std::fprintf(file, "2\t%.8f\n", mass_);
+      std::fprintf(file, "2\t%.8f\n", context.energy.mass_);
 
     // Atoms, id type x y z
     std::fprintf(file, "\nAtoms\n\n");
-    for (int i=0; i<node_positions_.size(); i++)
-      std::fprintf(file, "%i\t%i\t%.8f\t%.8f\t%.8f\n", i, get_type(node_if_emphasis_[i]),
-          node_positions_[i][0], node_positions_[i][1], node_positions_[i][2]);
+    for (int i=0; i<frame.size; i++)
+      std::fprintf(file, "%i\t%i\t%.8f\t%.8f\t%.8f\n", get_id(i), get_type(context.node_flags[i] & Metadata::kNodeEmphasis),
+          frame.positions(i, 0), frame.positions(i, 1), frame.positions(i, 2));
 
     // Bonds, id type a b
     std::fprintf(file, "\nBonds\n\n");
     int i = 0;
-    for (; i<bond_relations1_.size(); i++)
-      std::fprintf(file, "%i\t1\t%i\t%i\n", i, bond_relations1_[i][0], bond_relations1_[i][1]);
-    for (; i<bond_relations1_.size()+bond_relations2_.size(); i++)
-      std::fprintf(file, "%i\t2\t%i\t%i\n", i, bond_relations2_[i][0], bond_relations2_[i][1]);
+    for (; i<bond_relations1.size(); i++)
+      std::fprintf(file, "%i\t1\t%i\t%i\n", i, get_id(bond_relations1[i][0]),
+          get_id(bond_relations1[i][1]));
+    for (int j=0; j<bonds-bond_relations1.size(); i++, j++)
+      std::fprintf(file, "%i\t2\t%i\t%i\n", i, get_id(bond_relations2[j][0]),
+          get_id(bond_relations2[j][1]));
   }
   std::fclose(file);
 
+  // self-defined contents, in DumpColumns, evaluated already
+  std::vector<const char*> column_names;
+  for (int i=0; i<Metadata::DumpColumns::size; i++)
+    if (DUMP_CHECK(Metadata::DumpColumns::dump_types[i], dump_type))
+      column_names.push_back(Metadata::DumpColumns::names[i]);
+  auto columns = frame.columns.data();
+
+  // binary trajectory, topology is written only when file is created. Atoms are
+  // written in order of original ids
+  if (DUMP_CHECK(Metadata::kDumpBinary, dump_type)) {
+    UtilsTrajectory::Topology topology = {std::vector<int32_t>(frame.size),
+      std::vector<CoreMath::Pair<int>>(), std::vector<CoreMath::Pair<int>>(),
+      {0., boundary_max, 0., boundary_max, 0., boundary_max},
+      std::vector<std::string>(column_names.begin(), column_names.end()),
+      context.energy.mass_};
+    for (int i=0; i<frame.size; i++)
+      topology.types[get_id(i)] = get_type(context.node_flags[i] & Metadata::kNodeEmphasis);
+    for (int i=0; i<context.bond_relations1.size(); i++)
+      topology.bonds1.push_back(CoreMath::Pair<int>(get_id(context.bond_relations1[i][0]),
+          get_id(context.bond_relations1[i][1])));
+    if (!DUMP_CHECK(Metadata::kExcludeBondType2, dump_type))
+      for (int i=0; i<context.bond_relations2.size(); i++)
+        topology.bonds2.push_back(CoreMath::Pair<int>(get_id(context.bond_relations2[i][0]),
+            get_id(context.bond_relations2[i][1])));
+    std::vector<double> reordered;
+    if (ids.size() != 0) {
+      reordered.resize(column_names.size() * frame.size);
+      for (int k=0; k<column_names.size(); k++)
+        for (int i=0; i<frame.size; i++)
+          reordered[k*frame.size + ids[i]] = columns[k*frame.size + i];
+      columns = reordered.data();
+    }
+    std::vector<CoreMath::Vector> positions, velocities;
+    UtilsTrajectory::append(file_name + ".traj", topology, frame.time_step, frame.size,
+        frame_vectors(frame.positions, frame.size, ids, positions),
+        DUMP_CHECK(Metadata::kPrintVelocities, dump_type) ?
+        frame_vectors(frame.velocities, frame.size, ids, velocities) : nullptr, columns);
+    return;
+  }
+
   // dump trajectory, append file when time step is not 0
-  file = std::fopen((file_name + ".dump").c_str(), (__time_step != 0) ? "a" : "w");
+  file = std::fopen((file_name + ".dump").c_str(), (frame.time_step != 0) ? "a" : "w");
     
   // header
   std::fprintf(file, __dump_file_header, 
-    __time_step, node_positions_.size(), 0., boundary_max, 0., boundary_max, 0., boundary_max
+    frame.time_step, frame.size, 0., boundary_max, 0., boundary_max, 0., boundary_max
   );
   if (DUMP_CHECK(Metadata::kPrintVelocities, dump_type))
     std::fprintf(file, " vx vy vz");
-  
-  // self-defined contents, in kDumpMetaData
-  for (auto i : Metadata::kDumpMetaData) {
-    if (DUMP_CHECK(i.dump_type, dump_type))
-      std::fprintf(file, " %s", i.name);
-  }
+  for (auto i : column_names)
+    std::fprintf(file, " %s", i);
   std::fprintf(file, "\n");
 
   // data
-  for (int i=0; i<node_positions_.size(); i++) {
+  for (int i=0; i<frame.size; i++) {
     // basic: id type xs ys zs
-    std::fprintf(file, "%i\t%i\t%.8f\t%.8f\t%.8f", i, get_type(node_if_emphasis_[i]),
-      node_positions_[i][0], node_positions_[i][1], node_positions_[i][2]);
+    std::fprintf(file, "%i\t%i\t%.8f\t%.8f\t%.8f", get_id(i), get_type(context.node_flags[i] & Metadata::kNodeEmphasis),
+      frame.positions(i, 0), frame.positions(i, 1), frame.positions(i, 2));
     if (DUMP_CHECK(Metadata::kPrintVelocities, dump_type))
-      std::fprintf(file, "\t%.8f\t%.8f\t%.8f", node_velocities_[i][0], node_velocities_[i][1],
-        node_velocities_[i][2]);
-    
-    auto a = h_get_positions(i, node_adjacents_bonds1_[i]);
-    auto b = h_get_positions(i, node_adjacents_bonds2_[i]);
-    auto c = h_get_positions(i, node_adjacents_curvature_[i]);
-
-    for (auto j : Metadata::kDumpMetaData)
-      if (DUMP_CHECK(j.dump_type, dump_type))
-        std::fprintf(file, "\t%.8f", j.func_num(*this, a, b, c));
+      std::fprintf(file, "\t%.8f\t%.8f\t%.8f", frame.velocities(i, 0),
+        frame.velocities(i, 1), frame.velocities(i, 2));
+    for (int k=0; k<column_names.size(); k++)
+      std::fprintf(file, "\t%.8f", columns[k*frame.size + i]);
     std::fprintf(file, "\n");
   }
   std::fclose(file);
+}
 
-  return;
+} // namespace
+
+void ModelSystem::dump(std::string file_name, Metadata::DumpType dump_type) {
+  // others won't be changed by update, but by load, reorder or initializer
+  auto context = std::make_shared<const DumpContext>(DumpContext{*this, node_flags_,
+      node_ids_, bond_relations1_, bond_relations2_});
+
+  // custom columns are evaluated on device in parallel
+  auto& columns = __evaluate_columns(dump_type);
+
+  if (!DUMP_CHECK(Metadata::kDumpAsync, dump_type)) {
+    node_positions_.sync<HostMirrorSpace>();  
+    node_velocities_.sync<HostMirrorSpace>();
+    columns.sync<HostMirrorSpace>();
+    // host views are used directly, no copy. The whole capacity is wrapped to keep
+    // strides of NodeLayout
+    UtilsWriter::Frame frame = {file_name, __time_step, dump_type, node_positions_.size(),
+      UtilsWriter::Frame::View(node_positions_.h_view.data(), node_positions_.extent(0)),
+      UtilsWriter::Frame::View(node_velocities_.h_view.data(), node_velocities_.extent(0)),
+      UtilsWriter::Frame::ColumnView(columns.h_view.data(), columns.size()), 0};
+    write_dump(frame, *context);
+    return;
+  }
+
+  // writer lives until system is destroyed, every frame brings its own context
+  if (!__writer)
+    __writer = std::make_shared<UtilsWriter::AsyncWriter>([](
+        const UtilsWriter::Frame& frame) {
+      write_dump(frame, *static_cast<const DumpContext*>(frame.context.get()));
+    });
+
+  Kokkos::Timer timer;
+  UtilsWriter::Frame& frame = __writer->acquire();
+  node_positions_.sync<MemorySpace>();
+  node_velocities_.sync<MemorySpace>();
+  // the same extents (capacities) as device views, so that copies are contiguous
+  if (frame.positions.extent(0) != node_positions_.extent(0) ||
+      frame.velocities.extent(0) != node_velocities_.extent(0)) {
+    frame.positions = UtilsWriter::Frame::View("positions", node_positions_.extent(0));
+    frame.velocities = UtilsWriter::Frame::View("velocities", node_velocities_.extent(0));
+  }
+  if (frame.columns.extent(0) != columns.size())
+    frame.columns = UtilsWriter::Frame::ColumnView("columns", columns.size());
+  Kokkos::deep_copy(frame.positions, node_positions_.view_device());
+  Kokkos::deep_copy(frame.velocities, node_velocities_.view_device());
+  // only finished columns are copied
+  Kokkos::deep_copy(frame.columns, columns.view_device());
+  frame.file_name = file_name;
+  frame.time_step = __time_step;
+  frame.dump_type = dump_type;
+  frame.size = node_positions_.size();
+  frame.context = context;
+  __writer->submit(timer.seconds());
+}
+
+CoreMath::View<double>& ModelSystem::__evaluate_columns(Metadata::DumpType dump_type) {
+  update_pair_tables();
+  int count = Metadata::DumpColumns::count(dump_type);
+  auto& columns = __workspace.columns;
+  if (columns.size() != count * node_positions_.size())
+    columns.init(count * node_positions_.size());
+  if (count == 0)
+    return columns;
+
+  node_positions_.sync<MemorySpace>();
+  size_t n = node_positions_.size();
+  Kokkos::parallel_for(__range(n), KOKKOS_CLASS_LAMBDA(const int i) {
+    double result[Metadata::DumpColumns::size];
+    Metadata::DumpColumns::evaluate(dump_type, *this,
+        d_get_positions(i, csr_bonds1_(i)), d_get_positions(i, csr_bonds2_(i)),
+        d_get_positions(i, csr_curvature_(i)), result);
+    // column major, the same as file
+    for (int k=0; k<count; k++)
+      columns(k*n + i) = result[k];
+  });
+  columns.modify<MemorySpace>();
+  return columns;
 }
 
 void ModelSystem::store(std::string file_name) {
+  // header, scalars
+  CheckpointHeader header = {};
+  std::memcpy(header.magic, __checkpoint_magic, sizeof(header.magic));
+  header.version = __checkpoint_version;
+  header.endian = __checkpoint_endian;
+  header.time_step = __time_step;
+  header.counts[0] = node_if_emphasis_count_;
+  header.counts[1] = node_if_rigid1_count_;
+  header.counts[2] = node_if_next_to_rigid1_count_;
+  header.counts[3] = node_if_rigid2_count_;
+  header.counts[4] = node_if_next_to_rigid2_count_;
+  header.rand_seed = rand_pool_.seed();
+  header.rand_counter = rand_pool_.counter();
+  std::memcpy(header.parameters, parameters(), sizeof(header.parameters));
+  header.step_length = step_length_;
+  header.mass = mass_;
+  header.damp_coeff = damp_coeff_;
+  header.temperature = temperature_;
+  header.lattice = lattice_;
+  header.rigid_time_step = __workspace.rigid_time_step;
+  const CoreMath::Vector* rigid[6] = {&__workspace.center1, &__workspace.diagonal1,
+      &__workspace.off_diagonal1, &__workspace.center2, &__workspace.diagonal2,
+      &__workspace.off_diagonal2};
+  for (int k=0; k<6; k++)
+    for (int d=0; d<3; d++)
+      header.rigid[k][d] = (*rigid[k])[d];
+  header.time = __thermo.time;
+  header.noise_step = adaptive_step_.noise_step;
+  header.accepted = __thermo.accepted;
+  header.rejected = __thermo.rejected;
+  header.backup_time_step = __workspace.backup_time_step;
 
+  // backups can roll back the next step, so they are stored only while valid
+  std::vector<CoreMath::Vector> backups[3];
+  if (__workspace.backup_time_step == __time_step) {
+    for (auto& i : backups)
+      i.resize(node_velocities_.size());
+    checkpoint_vectors(__workspace.backup_positions, backups[0]);
+    checkpoint_vectors(__workspace.backup_velocities, backups[1]);
+    checkpoint_vectors(__workspace.last_forces, backups[2]);
+  } else {
+    header.backup_time_step = -1;
+  }
+
+  // section table, data blocks are aligned so that they can be mapped directly
+  std::vector<CheckpointSection> sections;
+  __for_each_view([&](const char* name, auto& view) {
+    view.template sync<HostMirrorSpace>();
+    CheckpointSection section = {};
+    std::strncpy(section.name, name, sizeof(section.name) - 1);
+    section.element_size = checkpoint_element_size(view);
+    section.size = view.size();
+    section.capacity = view.extent(0);
+    sections.push_back(section);
+  });
+  for (int k=0; k<3; k++) {
+    CheckpointSection section = {};
+    std::strncpy(section.name, __checkpoint_backups[k], sizeof(section.name) - 1);
+    section.element_size = sizeof(CoreMath::Vector);
+    section.size = section.capacity = backups[k].size();
+    sections.push_back(section);
+  }
+  header.section_number = sections.size();
+  uint64_t offset = checkpoint_align(sizeof(header) + sections.size()*sizeof(CheckpointSection));
+  for (auto& i : sections) {
+    i.offset = offset;
+    offset = checkpoint_align(offset + i.size*i.element_size);
+  }
+
+  // write into temporary file, then rename, so an old checkpoint is never broken
+  std::string temp_name = file_name + ".tmp";
+  FILE *file = std::fopen(temp_name.c_str(), "wb");
+  if (file == NULL) {
+    std::fprintf(stderr, "store: can't open %s\n", temp_name.c_str());
+    return;
+  }
+  bool success = std::fwrite(&header, sizeof(header), 1, file) == 1 &&
+      std::fwrite(sections.data(), sizeof(CheckpointSection), sections.size(), file) == sections.size();
+  int k = 0;
+  __for_each_view([&](const char*, auto& view) {
+    auto& section = sections[k++];
+    success = success && std::fseek(file, section.offset, SEEK_SET) == 0 &&
+        checkpoint_write(file, view);
+  });
+  for (auto& i : backups) {
+    auto& section = sections[k++];
+    success = success && std::fseek(file, section.offset, SEEK_SET) == 0 &&
+        std::fwrite(i.data(), sizeof(CoreMath::Vector), i.size(), file) == i.size();
+  }
+  success = success && std::fflush(file) == 0 && fsync(fileno(file)) == 0;
+  success = (std::fclose(file) == 0) && success;
+  if (!success || std::rename(temp_name.c_str(), file_name.c_str()) != 0) {
+    std::fprintf(stderr, "store: failed to write %s\n", file_name.c_str());
+    std::remove(temp_name.c_str());
+  }
 }
 
 void ModelSystem::load(std::string file_name) {
+  int fd = open(file_name.c_str(), O_RDONLY);
+  struct stat file_stat;
+  if (fd < 0 || fstat(fd, &file_stat) != 0 ||
+      static_cast<size_t>(file_stat.st_size) < sizeof(CheckpointHeader))
+    Kokkos::abort(("load: can't read " + file_name).c_str());
+  void* map = mmap(NULL, file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED)
+    Kokkos::abort(("load: can't map " + file_name).c_str());
+  const char* base = static_cast<const char*>(map);
 
+  // header, scalars
+  CheckpointHeader header;
+  std::memcpy(&header, base, sizeof(header));
+  if (std::memcmp(header.magic, __checkpoint_magic, sizeof(header.magic)) != 0)
+    Kokkos::abort(("load: " + file_name + " isn't a checkpoint").c_str());
+  if (header.endian != __checkpoint_endian)
+    Kokkos::abort(("load: " + file_name + " has different byte order").c_str());
+  if (header.version != __checkpoint_version)
+    Kokkos::abort(("load: " + file_name + " has unsupported version").c_str());
+  __time_step = header.time_step;
+  node_if_emphasis_count_ = header.counts[0];
+  node_if_rigid1_count_ = header.counts[1];
+  node_if_next_to_rigid1_count_ = header.counts[2];
+  node_if_rigid2_count_ = header.counts[3];
+  node_if_next_to_rigid2_count_ = header.counts[4];
+  rand_pool_.set_state(header.rand_seed, header.rand_counter);
+  std::memcpy(parameters(), header.parameters, sizeof(header.parameters));
+  step_length_ = header.step_length;
+  mass_ = header.mass;
+  damp_coeff_ = header.damp_coeff;
+  temperature_ = header.temperature;
+  lattice_ = static_cast<Metadata::Lattice>(header.lattice);
+
+  // section table must lie inside the file before anything of it is read
+  uint64_t file_size = file_stat.st_size;
+  uint64_t section_number = 0;
+  __for_each_view([&](const char*, auto&) { section_number++; });
+  section_number += 3;
+  if (header.section_number != section_number ||
+      sizeof(header) + section_number*sizeof(CheckpointSection) > file_size)
+    Kokkos::abort(("load: section table of " + file_name + " is broken").c_str());
+
+  // views, copy mapped blocks into host mirrors directly
+  const CheckpointSection* sections =
+      reinterpret_cast<const CheckpointSection*>(base + sizeof(header));
+  int k = 0;
+  __for_each_view([&](const char* name, auto& view) {
+    const CheckpointSection& section = sections[k++];
+    // sizes are checked by division, so that huge ones can't overflow
+    if (std::strncmp(section.name, name, sizeof(section.name)) != 0 ||
+        section.element_size != checkpoint_element_size(view) ||
+        section.capacity < section.size || (section.size != 0 &&
+            (section.offset > file_size ||
+             section.size > (file_size - section.offset) / section.element_size)) ||
+        section.capacity > std::numeric_limits<int>::max() ||
+        !checkpoint_valid(view, base + section.offset, section.size))
+      Kokkos::abort(("load: section " + std::string(name) + " is broken").c_str());
+    view.init(section.size, section.capacity);
+    checkpoint_read(view, base + section.offset);
+    view.modify_host();
+    view.sync_device();
+  });
+
+  // backups of adaptive step, with the extents __adapt_step allocates them with
+  int n = node_velocities_.size();
+  bool backup = header.backup_time_step == header.time_step;
+  for (int i=0; i<3; i++) {
+    const CheckpointSection& section = sections[k++];
+    if (std::strncmp(section.name, __checkpoint_backups[i], sizeof(section.name)) != 0 ||
+        section.element_size != sizeof(CoreMath::Vector) ||
+        section.size != (backup ? n : 0) || (section.size != 0 &&
+            (section.offset > file_size ||
+             section.size > (file_size - section.offset) / section.element_size)))
+      Kokkos::abort(("load: section " + std::string(__checkpoint_backups[i]) +
+          " is broken").c_str());
+  }
+  if (backup) {
+    auto& w = __workspace;
+    Kokkos::realloc(w.backup_positions, node_positions_.extent(0));
+    Kokkos::realloc(w.backup_velocities, node_velocities_.extent(0));
+    Kokkos::realloc(w.forces, n);
+    Kokkos::realloc(w.last_forces, n);
+    checkpoint_read(w.backup_positions, base + sections[k - 3].offset, n);
+    checkpoint_read(w.backup_velocities, base + sections[k - 2].offset, n);
+    checkpoint_read(w.last_forces, base + sections[k - 1].offset, n);
+  }
+  munmap(map, file_stat.st_size);
+
+  resize_workspace();
+  __thermo.time = header.time;
+  __thermo.accepted = header.accepted;
+  __thermo.rejected = header.rejected;
+  if (header.noise_step != 0)
+    adaptive_step_.noise_step = header.noise_step;
+  __workspace.backup_time_step = backup ? header.backup_time_step : -1;
+  CoreMath::Vector* rigid[6] = {&__workspace.center1, &__workspace.diagonal1,
+      &__workspace.off_diagonal1, &__workspace.center2, &__workspace.diagonal2,
+      &__workspace.off_diagonal2};
+  for (int k=0; k<6; k++)
+    *rigid[k] = CoreMath::Vector(header.rigid[k][0], header.rigid[k][1], header.rigid[k][2]);
+  __workspace.rigid_time_step = header.rigid_time_step;
 }
 
-void ModelSystem::update(bool just_velocity) {
-  // gradients of curvature
-  Kokkos::View<CoreMath::Array<CoreMath::Vector>*> gradients("", node_velocities_.size());
+void ModelSystem::reorder() {
+  // relations are renumbered in place, pending dumps still read them
+  if (__writer)
+    __writer->flush();
+  __for_each_view([](const char*, auto& view) { view.template sync<HostMirrorSpace>(); });
+  int n = node_positions_.size();
+  if (node_ids_.size() != n) {
+    node_ids_.init(n, node_positions_.extent(0));
+    for (int i=0; i<n; i++)
+      node_ids_[i] = i;
+  }
 
-  // update using bonds
-  Kokkos::parallel_for(node_velocities_.size(), KOKKOS_CLASS_LAMBDA(const int i) {
-    // if it's not boundary or next to bound, curvature will take effect
-    if (!node_if_rigid1_(i) && !node_if_rigid2_(i) && 
-        !node_if_next_to_rigid1_(i) && !node_if_next_to_rigid2_(i)) {
-      auto positions = d_get_positions(i, node_adjacents_curvature_(i));
-      gradients(i) = curvature_gradient(positions);
+  // neighbours by any kind of adjacents, duplicates don't matter
+  auto degree = [&](int i) {
+    return node_adjacents_bonds1_[i].size() + node_adjacents_bonds2_[i].size() +
+        node_adjacents_curvature_[i].size();
+  };
+  auto for_each_adjacent = [&](int i, auto f) {
+    for (auto j : node_adjacents_bonds1_[i]) f(j);
+    for (auto j : node_adjacents_bonds2_[i]) f(j);
+    for (auto j : node_adjacents_curvature_[i]) f(j);
+  };
+
+  // Cuthill-McKee: breadth first from a peripheral node of every component,
+  // unvisited adjacents in ascending degree, then reversed
+  std::vector<int> order, level(n, -1), adjacents;
+  order.reserve(n);
+  auto bfs = [&](int root) {
+    size_t begin = order.size();
+    order.push_back(root);
+    level[root] = 0;
+    for (size_t k=begin; k<order.size(); k++) {
+      int i = order[k];
+      adjacents.clear();
+      for_each_adjacent(i, [&](int j) {
+        if (level[j] < 0) {
+          level[j] = level[i] + 1;
+          adjacents.push_back(j);
+        }
+      });
+      std::stable_sort(adjacents.begin(), adjacents.end(),
+          [&](int a, int b) { return degree(a) < degree(b); });
+      order.insert(order.end(), adjacents.begin(), adjacents.end());
+    }
+    return begin;
+  };
+  for (int i=0; i<n; i++) {
+    if (level[i] >= 0)
+      continue;
+    // pseudo-peripheral root: move to the last level while eccentricity grows
+    int root = i, eccentricity = -1;
+    while (true) {
+      size_t begin = bfs(root);
+      int last = order.back();
+      for (size_t k=begin; k<order.size(); k++)
+        if (level[order[k]] == level[last] && degree(order[k]) < degree(last))
+          last = order[k];
+      bool grown = level[last] > eccentricity;
+      eccentricity = level[last];
+      for (size_t k=begin; k<order.size(); k++)
+        level[order[k]] = -1;
+      order.resize(begin);
+      if (!grown)
+        break;
+      root = last;
+    }
+    bfs(root);
+  }
+  std::reverse(order.begin(), order.end());
+
+  // order[new] is old, rank[old] is new
+  std::vector<int> rank(n);
+  for (int i=0; i<n; i++)
+    rank[order[i]] = i;
+  permute_nodes(node_positions_, order);
+  permute_nodes(node_velocities_, order);
+  permute_nodes(node_flags_, order);
+  permute_nodes(node_ids_, order);
+  for (auto adjacents : {&node_adjacents_bonds1_, &node_adjacents_bonds2_,
+      &node_adjacents_curvature_}) {
+    for (int i=0; i<adjacents->size(); i++)
+      for (auto& j : (*adjacents)[i])
+        j = rank[j];
+    permute_nodes(*adjacents, order);
+  }
+  for (auto relations : {&bond_relations1_, &bond_relations2_}) {
+    for (int i=0; i<relations->size(); i++)
+      (*relations)[i] = CoreMath::Pair<int>(rank[(*relations)[i][0]], rank[(*relations)[i][1]]);
+    relations->modify_host();
+    relations->sync_device();
+  }
+
+  resize_workspace();
+}
+
+template <typename Policy>
+void ModelSystem::__scatter_bonds() {
+  bool atomic = bond_scheme_ == kBondAtomic;
+  for (int type=1; type<=(Policy::kBond2 ? 2 : 1); type++) {
+    auto bonds = (type == 1) ? force_bonds1_ : force_bonds2_;
+    auto& colors = (type == 1) ? force_bond_colors1_ : force_bond_colors2_;
+    // gradient of a bond is evaluated once, ends get it with opposite signs
+    auto kernel = KOKKOS_CLASS_LAMBDA(const int k) {
+      auto bond = bonds(k);
+      auto r = CoreMath::RealVector(node_positions_(bond[1]) - node_positions_(bond[0]));
+      CoreMath::RealVector gradient;
+      if constexpr (Policy::kBond2)
+        gradient = (type == 1) ? bond1_gradient(r) : bond2_gradient(r);
+      else
+        gradient = bond1_gradient(r);
+      if (atomic) {
+        node_velocities_(bond[0]).atomic_add(gradient);
+        node_velocities_(bond[1]).atomic_add(-gradient);
+      } else {
+        node_velocities_(bond[0]) += gradient;
+        node_velocities_(bond[1]) += -gradient;
+      }
+    };
+    if (atomic) {
+      Kokkos::parallel_for(__range(bonds.size()), kernel);
     } else {
-      gradients(i) = CoreMath::Array<CoreMath::Vector>(node_adjacents_curvature_(i).size());
+      for (int c=0; c+1<colors.size(); c++)
+        Kokkos::parallel_for(__range(colors[c], colors[c+1]), kernel);
     }
+  }
+}
 
+void ModelSystem::__scatter_curvature() {
+  // gradient of i's curvature energy with respect to adjacent j, i gets the sum
+  auto kernel = KOKKOS_CLASS_LAMBDA(const int k) {
+    int i = curvature_nodes_(k);
+    auto curvature = csr_curvature_(i);
+    auto gradient = curvature_gradient(d_get_positions(i, curvature));
     CoreMath::Vector reduced;
-    CoreMath::Array<int> position1 = node_adjacents_bonds1_(i), 
-        position2 = node_adjacents_bonds2_(i);
-    // If it's boundary nodes, don't count its related boundary nodes (for rigid body).
-    if (node_if_rigid1_(i) || node_if_rigid2_(i)) {
-      for (auto j=position1.begin(); j!=position1.end(); ) {
-        // The node has been erased, the same place has the diffrent node needing a second count.
-        if (node_if_rigid1_(*j) || node_if_rigid2_(*j))
-          position1.erase(j);
-        else j++;
+    for (int j=0; j<curvature.size(); j++) {
+      reduced += gradient[j];
+      node_velocities_(curvature[j]) += -gradient[j];
+    }
+    node_velocities_(i) += reduced;
+  };
+  for (int c=0; c+1<curvature_groups_.size(); c++)
+    Kokkos::parallel_for(__range(curvature_groups_[c], curvature_groups_[c+1]),
+        kernel);
+}
+
+void ModelSystem::__batch_curvature() {
+  using Simd = CoreMath::RealSimd;
+  constexpr int width = Simd::size();
+  auto gradients = __workspace.gradients;
+  // one group of nodes with the same degree per thread, a node per lane
+  Kokkos::parallel_for(__range(curvature_groups_.size() - 1),
+      KOKKOS_CLASS_LAMBDA(const int g) {
+    int begin = curvature_groups_(g), count = curvature_groups_(g + 1) - begin;
+    int degree = csr_curvature_(curvature_nodes_(begin)).size();
+    // lane-major scratch, lanes after count repeat the first node and are dropped
+    CoreMath::Real scratch[3][width];
+    CoreMath::Array<CoreMath::BasicVector<Simd>> others(degree);
+    for (int j=0; j<degree; j++) {
+      for (int l=0; l<width; l++) {
+        int i = curvature_nodes_(begin + ((l < count) ? l : 0));
+        auto p = CoreMath::RealVector(node_positions_(csr_curvature_(i)[j]) - node_positions_(i));
+        for (int d=0; d<3; d++)
+          scratch[d][l] = p[d];
       }
-      for (auto j=position2.begin(); j!=position2.end(); ) {
-        if (node_if_rigid1_(*j) || node_if_rigid2_(*j))
-          position2.erase(j);
-        else j++;
+      for (int d=0; d<3; d++)
+        others[j][d].copy_from(scratch[d], Kokkos::Experimental::element_aligned_tag());
+    }
+
+    auto gradient = curvature_gradient(others);
+    for (int j=0; j<degree; j++) {
+      for (int d=0; d<3; d++)
+        gradient[j][d].copy_to(scratch[d], Kokkos::Experimental::element_aligned_tag());
+      for (int l=0; l<count; l++) {
+        int i = curvature_nodes_(begin + l);
+        gradients(csr_curvature_.offset(i) + j) =
+            CoreMath::RealVector(scratch[0][l], scratch[1][l], scratch[2][l]);
+      }
+    }
+  });
+}
+
+void ModelSystem::resize_workspace() {
+  csr_bonds1_.build(node_adjacents_bonds1_);
+  csr_bonds2_.build(node_adjacents_bonds2_);
+  csr_curvature_.build(node_adjacents_curvature_);
+  // entry of i in the row of its adjacent, so gradients can be gathered without
+  // searching in kernels
+  csr_curvature_reverse_.init(csr_curvature_.entries());
+  for (int i=0; i<node_adjacents_curvature_.size(); i++)
+    for (int j=0; j<node_adjacents_curvature_[i].size(); j++) {
+      int a = node_adjacents_curvature_[i][j];
+      auto& others = node_adjacents_curvature_[a];
+      csr_curvature_reverse_[csr_curvature_.offsets[i] + j] =
+          csr_curvature_.offsets[a] + (others.find(i) - others.begin());
+    }
+  csr_curvature_reverse_.modify_host();
+  csr_curvature_reverse_.sync_device();
+
+  // rigid-rigid bonds never have forces, exclude them once here
+  auto force = [&](int i, int j) {
+    return !((node_flags_[i] & Metadata::kNodeRigid) && (node_flags_[j] & Metadata::kNodeRigid));
+  };
+  csr_force_bonds1_.build(node_adjacents_bonds1_, force);
+  csr_force_bonds2_.build(node_adjacents_bonds2_, force);
+  color_bonds(bond_relations1_, node_flags_, force_bonds1_, force_bond_colors1_);
+  color_bonds(bond_relations2_, node_flags_, force_bonds2_, force_bond_colors2_);
+
+  if (curvature_scheme_ == kCurvatureColored) {
+    color_curvature(node_adjacents_curvature_, node_flags_, curvature_nodes_,
+        curvature_groups_);
+  } else if (curvature_scheme_ == kCurvatureBatch) {
+    batch_curvature(node_adjacents_curvature_, node_flags_, CoreMath::RealSimd::size(),
+        curvature_nodes_, curvature_groups_);
+  } else {
+    curvature_nodes_.init(0);
+    curvature_groups_.init(0);
+  }
+  __workspace.curvature_scheme = curvature_scheme_;
+
+  // compact lists of rigid bodies, ascending, ghosts move with their owners
+  auto collect = [&](Metadata::NodeFlag mask, CoreMath::View<int>& nodes) {
+    nodes.init(0, node_flags_.size());
+    for (int i=0; i<node_flags_.size(); i++)
+      if ((node_flags_[i] & mask) && !(node_flags_[i] & Metadata::kNodeGhost))
+        nodes.push_back(i);
+    nodes.modify_host();
+    nodes.sync_device();
+  };
+  collect(Metadata::kNodeRigid1, rigid_nodes1_);
+  collect(Metadata::kNodeRigid2, rigid_nodes2_);
+  __workspace.rigid_time_step = -1;
+  __workspace.free_nodes = 0;
+  for (int i=0; i<node_flags_.size(); i++)
+    __workspace.free_nodes += !(node_flags_[i] & (Metadata::kNodeRigid | Metadata::kNodeGhost));
+
+  Kokkos::realloc(__workspace.gradients, __gradients_size());
+  Kokkos::realloc(__workspace.noises, node_velocities_.size());
+  Kokkos::realloc(__workspace.fire_velocities, node_velocities_.size());
+  __workspace.backup_time_step = -1;
+}
+
+size_t ModelSystem::workspace_bytes() const {
+  return __workspace.gradients.span() * sizeof(CoreMath::RealVector) +
+      (__workspace.noises.span() + __workspace.backup_positions.span() +
+      __workspace.backup_velocities.span() + __workspace.forces.span() +
+      __workspace.last_forces.span() + __workspace.fire_velocities.span()) *
+      sizeof(CoreMath::Vector);
+}
+
+size_t ModelSystem::topology_bytes() const {
+  return csr_bonds1_.bytes() + csr_bonds2_.bytes() + csr_curvature_.bytes() +
+      csr_curvature_reverse_.extent(0) * sizeof(int) + csr_force_bonds1_.bytes() +
+      csr_force_bonds2_.bytes() + (force_bonds1_.extent(0) + force_bonds2_.extent(0)) *
+      sizeof(CoreMath::Pair<int>) + (force_bond_colors1_.extent(0) +
+      force_bond_colors2_.extent(0) + curvature_nodes_.extent(0) +
+      curvature_groups_.extent(0) + rigid_nodes1_.size() + rigid_nodes2_.size()) *
+      sizeof(int);
+}
+
+void ModelSystem::update(bool just_velocity) {
+  // observables of thermo are reduced by the same kernels on required steps
+  bool thermo = !just_velocity && thermo_every_ > 0 && __time_step % thermo_every_ == 0;
+  // adaptive step needs all velocities before anything moves
+  bool fused = fused_step_ && !just_velocity && !adaptive_step_.enable;
+  __update_velocities(true, thermo && DUMP_CHECK(Metadata::kThermoEnergy, thermo_type_),
+      thermo && (DUMP_CHECK(Metadata::kThermoMaxForce, thermo_type_) ||
+      DUMP_CHECK(Metadata::kThermoVelocity, thermo_type_)), fused);
+  if (just_velocity)
+    return;
+
+  if (adaptive_step_.enable) {
+    // observables of a rolled back state aren't printed
+    int time_step = __time_step;
+    step_length_ = __adapt_step();
+    thermo = thermo && time_step == __time_step;
+  }
+  __update_rigid(step_length_);
+  // interior nodes have moved already in fused step
+  if (!fused)
+    __move_interior(step_length_);
+  __exchange_halo();
+  
+  if (thermo) {
+    __thermo.time_step = __time_step;
+    __thermo.step_length = step_length_;
+    __thermo.force1 = __workspace.force1;
+    __thermo.moment1 = __workspace.moment1;
+    __thermo.force2 = __workspace.force2;
+    __thermo.moment2 = __workspace.moment2;
+    __print_thermo();
+  }
+
+  __time_step++;
+}
+
+void ModelSystem::__update_velocities(bool thermal, bool thermo_energy, bool thermo_motion,
+    bool fused) {
+  with_policy([&](auto policy) {
+    __update_velocities<decltype(policy)>(thermal, thermo_energy, thermo_motion, fused);
+  });
+}
+
+template <typename Policy>
+void ModelSystem::__update_velocities(bool thermal, bool thermo_energy, bool thermo_motion,
+    bool fused) {
+  // only happens when nodes are inserted or removed, or scheme is changed
+  if (csr_curvature_.rows() != node_velocities_.size() ||
+      __workspace.gradients.extent(0) != __gradients_size() ||
+      __workspace.curvature_scheme != curvature_scheme_)
+    resize_workspace();
+  update_pair_tables();
+  auto gradients = __workspace.gradients;
+  auto noises = __workspace.noises;
+  // random number, avoid waste when temperature equals 0
+  bool noise = thermal && temperature_ != 0;
+  // interior nodes are final after the last pass, fused step moves them there
+  double step = fused ? step_length_ : 0;
+  bool streams = node_streams_.size() != 0;
+
+  // update using bonds
+  auto bonds_kernel = KOKKOS_CLASS_LAMBDA(const int i, double& energy1, double& energy2,
+      double& energy3) {
+    auto flag = node_flags_(i);
+    // ghosts are counted by their owners
+    bool energy = thermo_energy && !(flag & Metadata::kNodeGhost);
+    // if it's not boundary or next to bound, curvature will take effect
+    // gradients are stored for gather, or evaluated group by group later
+    if constexpr (Policy::kCurvature) {
+      auto curvature = csr_curvature_(i);
+      if (curvature_scheme_ == kCurvatureGather) {
+        auto positions = d_get_positions(i, curvature);
+        __curvature_gradients(*this, positions, flag & Metadata::kNodeNearRigid, gradients,
+            csr_curvature_.offset(i));
+        if (energy)
+          energy3 += curvature_energy(positions);
+      } else {
+        // nodes outside groups of batches have no gradients
+        if (curvature_scheme_ == kCurvatureBatch && (flag & Metadata::kNodeNearRigid)) {
+          int offset = csr_curvature_.offset(i);
+          for (int j=0; j<curvature.size(); j++)
+            gradients(offset + j) = CoreMath::RealVector();
+        }
+        if (energy)
+          energy3 += curvature_energy(d_get_positions(i, curvature));
       }
     }
-    // total force arised from bonds of type 1
-    for (auto j : d_get_positions(i, position1))
-      reduced += bond1_gradient(j);
-    // total force arised from bonds of type 2
-    for (auto j : d_get_positions(i, position2))
-      reduced += bond2_gradient(j);
+
+    // energies count every bond once (half from each node), rigid ones included
+    if (energy)
+      __bond_energies<Policy>(*this, node_positions_, i, csr_bonds1_(i), csr_bonds2_(i),
+          energy1, energy2);
+
+    // forces of bonds are gathered here, or scattered bond by bond later. Bonds
+    // between rigid nodes are excluded by csr_force_bonds (for rigid body).
+    CoreMath::Vector reduced;
+    if (bond_scheme_ == kBondGather)
+      reduced = __bond_forces<Policy>(*this, node_positions_, i, csr_force_bonds1_(i),
+          csr_force_bonds2_(i));
 
     // here node velocities are just -div(), divide by damp_coeff_ later
     node_velocities_(i) = reduced;
-  });
 
-  // another loop because we need to wait for every gradient finish
-  Kokkos::parallel_for(node_velocities_.size(), KOKKOS_CLASS_LAMBDA(const int i) {
+    if (noise && !(flag & Metadata::kNodeRigid))
+      noises(i) = rand_pool_.gen_vector(Kokkos::sqrt(2*damp_coeff_*temperature_*K_B/mass_),
+          streams ? node_streams_(i) : i);
+  };
+  if (thermo_energy) {
+    Kokkos::parallel_reduce(__range(node_velocities_.size()), bonds_kernel,
+        __thermo.bond1_energy, __thermo.bond2_energy, __thermo.curvature_energy);
+    double energies[3] = {__thermo.bond1_energy, __thermo.bond2_energy,
+        __thermo.curvature_energy};
+    allreduce(energies, 3);
+    __thermo.bond1_energy = energies[0];
+    __thermo.bond2_energy = energies[1];
+    __thermo.curvature_energy = energies[2];
+  } else {
+    Kokkos::parallel_for(__range(node_velocities_.size()), KOKKOS_LAMBDA(const int i) {
+      double energy1, energy2, energy3;
+      bonds_kernel(i, energy1, energy2, energy3);
+    });
+  }
+  if (noise)
+    rand_pool_.advance();
+  if (bond_scheme_ != kBondGather)
+    __scatter_bonds<Policy>();
+  if (Policy::kCurvature && curvature_scheme_ == kCurvatureColored)
+    __scatter_curvature();
+  if (Policy::kCurvature && curvature_scheme_ == kCurvatureBatch)
+    __batch_curvature();
+
+  // another loop because we need to wait for every gradient finish. Gradients of
+  // curvature are gathered here, or have been scattered already
+  auto curvature_kernel = KOKKOS_CLASS_LAMBDA(const int i, double& max_force,
+      double& velocity2) {
+    bool rigid = node_flags_(i) & Metadata::kNodeRigid;
+    bool observed = thermo_motion && !(node_flags_(i) & (Metadata::kNodeRigid |
+        Metadata::kNodeGhost));
     // force arised from other node's curvature
     CoreMath::Vector reduced;
     // reduced vector for this node itself, no need to use parallel_reduce
-    for (int j=0; j<gradients(i).size(); j++)
-      reduced += gradients(i)[j];
-
-    for (int j=0; j<node_adjacents_curvature_(i).size(); j++) {
-      int adj = node_adjacents_curvature_(i)[j];
-      // find related bond of adj and i
-      for (int k=0; k<node_adjacents_curvature_(adj).size(); k++)
-        if (node_adjacents_curvature_(adj)[k] == i) {
-          reduced += -gradients(adj)[k];
-          break;
-        }
+    if (Policy::kCurvature && curvature_scheme_ != kCurvatureColored)
+      reduced = __gather_curvature(gradients, csr_curvature_reverse_,
+          csr_curvature_.offset(i), csr_curvature_.offset(i + 1));
+
+    // force without noise, rigid nodes are excluded because they move as a whole
+    if (observed) {
+      double force = CoreMath::mod(node_velocities_(i) + reduced);
+      max_force = (force > max_force) ? force : max_force;
     }
 
-    // random number, avoid waste when temperature equals 0
-    if (temperature_ != 0 && !node_if_rigid1_(i) && !node_if_rigid2_(i))
-      reduced += rand_pool_.gen_vector(Kokkos::sqrt(2*damp_coeff_*temperature_*K_B/mass_));
+    if (noise && !rigid)
+      reduced += noises(i);
     node_velocities_(i) = (node_velocities_(i) + reduced) / damp_coeff_;
-  });
+
+    if (observed)
+      velocity2 += node_velocities_(i) * node_velocities_(i);
+    if (step != 0 && !rigid)
+      node_positions_(i) += node_velocities_(i) * step;
+  };
+  if (thermo_motion) {
+    double velocity2 = 0;
+    Kokkos::parallel_reduce(__range(node_velocities_.size()), curvature_kernel,
+        Kokkos::Max<double>(__thermo.max_force), velocity2);
+    double sums[2] = {velocity2, static_cast<double>(__workspace.free_nodes)};
+    allreduce(sums, 2);
+    allreduce(&__thermo.max_force, 1, true);
+    __thermo.rms_velocity = Kokkos::sqrt(sums[0] / sums[1]);
+  } else {
+    Kokkos::parallel_for(__range(node_velocities_.size()), KOKKOS_LAMBDA(const int i) {
+      double max_force, velocity2;
+      curvature_kernel(i, max_force, velocity2);
+    });
+  }
 
   node_velocities_.modify<MemorySpace>();
-  Kokkos::fence();
-  if (just_velocity)
-    return;
-  
-  // Center of mass, inertia tensor, total force, total moment, angular acceleration
-  CoreMath::Vector center1, tensor1, force1, moment1, center2, tensor2, force2, moment2;
-  // update non-boundary and boundary nodes
-  Kokkos::parallel_reduce(node_positions_.size(), KOKKOS_CLASS_LAMBDA(const int i,
-      CoreMath::Vector& center_inner1, CoreMath::Vector& center_inner2) {
-    if (node_if_rigid1_(i)) {
-      center_inner1 += node_positions_(i);
-    } else if (node_if_rigid2_(i)) {
-      center_inner2 += node_positions_(i);
-    } else {
-      node_positions_(i) += node_velocities_(i) * step_length_;
+  if (step != 0)
+    node_positions_.modify<MemorySpace>();
+  execution_space_.fence();
+}
+
+double ModelSystem::__adapt_step() {
+  int n = node_velocities_.size();
+  auto& backup_positions = __workspace.backup_positions;
+  auto& backup_velocities = __workspace.backup_velocities;
+  auto& forces = __workspace.forces, & last_forces = __workspace.last_forces;
+  // backups have the same extents (capacities) as views, so that copies are contiguous
+  if (forces.extent(0) != n || backup_positions.extent(0) != node_positions_.extent(0) ||
+      backup_velocities.extent(0) != node_velocities_.extent(0)) {
+    Kokkos::realloc(backup_positions, node_positions_.extent(0));
+    Kokkos::realloc(backup_velocities, node_velocities_.extent(0));
+    Kokkos::realloc(forces, n);
+    Kokkos::realloc(last_forces, n);
+    __workspace.backup_time_step = -1;
+  }
+  // amplitude of random forces is the one of the step adaptation starts with
+  if (adaptive_step_.noise_step == 0)
+    adaptive_step_.noise_step = step_length_;
+  // last step can be checked only if nothing happens after it
+  bool check = __workspace.backup_time_step == __time_step;
+  bool noise = temperature_ != 0;
+  auto noises = __workspace.noises;
+
+  // largest velocity and largest change of deterministic velocities, rigid nodes
+  // are excluded because they move as a whole
+  double max_velocity2 = 0, max_change2 = 0;
+  Kokkos::parallel_reduce(__range(n), KOKKOS_CLASS_LAMBDA(const int i,
+      double& max_velocity_inner, double& max_change_inner) {
+    if (node_flags_(i) & (Metadata::kNodeRigid | Metadata::kNodeGhost))
+      return;
+    CoreMath::Vector velocity = node_velocities_(i);
+    forces(i) = noise ? velocity - noises(i) / damp_coeff_ : velocity;
+    double velocity2 = velocity * velocity;
+    max_velocity_inner = (velocity2 > max_velocity_inner) ? velocity2 : max_velocity_inner;
+    if (check) {
+      auto change = forces(i) - last_forces(i);
+      double change2 = change * change;
+      max_change_inner = (change2 > max_change_inner) ? change2 : max_change_inner;
+    }
+  }, Kokkos::Max<double>(max_velocity2), Kokkos::Max<double>(max_change2));
+  double maxima[2] = {max_velocity2, max_change2};
+  allreduce(maxima, 2, true);
+  max_velocity2 = maxima[0];
+  max_change2 = maxima[1];
+
+  bool accepted = !check || step_length_ <= adaptive_step_.min_step ||
+      Kokkos::sqrt(max_change2) * step_length_ <= adaptive_step_.max_change;
+  double step;
+  if (accepted) {
+    __thermo.accepted++;
+    step = step_length_ * (check ? adaptive_step_.growth : 1);
+    if (max_velocity2 * step * step > adaptive_step_.max_move * adaptive_step_.max_move)
+      step = adaptive_step_.max_move / Kokkos::sqrt(max_velocity2);
+    step = Kokkos::fmax(Kokkos::fmin(step, adaptive_step_.max_step), adaptive_step_.min_step);
+    // keep the state this step starts from
+    Kokkos::deep_copy(execution_space_, backup_positions, node_positions_.d_view);
+    Kokkos::deep_copy(execution_space_, backup_velocities, node_velocities_.d_view);
+    std::swap(forces, last_forces);
+  } else {
+    // roll back, velocities of last state are still valid, noises included
+    __thermo.accepted--;
+    __thermo.rejected++;
+    __time_step--;
+    __thermo.time -= step_length_;
+    step = Kokkos::fmax(step_length_ / 2, adaptive_step_.min_step);
+    Kokkos::deep_copy(execution_space_, node_positions_.d_view, backup_positions);
+    Kokkos::deep_copy(execution_space_, node_velocities_.d_view, backup_velocities);
+    node_positions_.modify<MemorySpace>();
+    node_velocities_.modify<MemorySpace>();
+  }
+
+  // random forces diffuse nodes as much as in steps of noise_step, velocities (or
+  // their backups) keep noises of amplitude at noise_step until here
+  if (noise && step != adaptive_step_.noise_step) {
+    double scale = Kokkos::sqrt(adaptive_step_.noise_step / step);
+    Kokkos::parallel_for(__range(n), KOKKOS_CLASS_LAMBDA(const int i) {
+      if (!(node_flags_(i) & (Metadata::kNodeRigid | Metadata::kNodeGhost)))
+        node_velocities_(i) = last_forces(i) + (node_velocities_(i) - last_forces(i)) * scale;
+    });
+    node_velocities_.modify<MemorySpace>();
+  }
+
+  if (!adaptive_step_.log_file.empty()) {
+    if (!__step_log) {
+      auto file = std::fopen(adaptive_step_.log_file.c_str(), "w");
+      if (file == nullptr)
+        std::fprintf(stderr, "cannot open %s\n", adaptive_step_.log_file.c_str());
+      else
+        __step_log.reset(file, std::fclose);
     }
-  }, center1, center2);
-
-  center1 = center1 / node_if_rigid1_count_;
-  center2 = center2 / node_if_rigid2_count_;
-
-  // calculate with rigid body
-  Kokkos::parallel_reduce(node_positions_.size(), KOKKOS_CLASS_LAMBDA(const int i,
-      CoreMath::Vector& force_inner1, CoreMath::Vector& force_inner2,
-      CoreMath::Vector& moment_inner1, CoreMath::Vector& moment_inner2,
-      CoreMath::Vector& tensor_inner1, CoreMath::Vector& tensor_inner2) {
-    if (node_if_rigid1_(i)) {
-      auto force = damp_coeff_ * node_velocities_(i);
-      force_inner1 += force;
-      auto t = node_positions_(i) - center1;
-      moment_inner1 += CoreMath::cross(t, force);
-      tensor_inner1 += CoreMath::Vector(t[1]*t[1]+t[2]*t[2], t[0]*t[0]+t[2]*t[2], t[0]*t[0]+t[1]*t[1]);
-    } else if (node_if_rigid2_(i)) {
-      auto force = damp_coeff_ * node_velocities_(i);
-      force_inner2 += force;
-      auto t = node_positions_(i) - center2;
-      moment_inner2 += CoreMath::cross(t, force);
-      tensor_inner2 += CoreMath::Vector(t[1]*t[1]+t[2]*t[2], t[0]*t[0]+t[2]*t[2], t[0]*t[0]+t[1]*t[1]);
+    if (__step_log) {
+      // the rejected step is logged with the step it was done with
+      if (!accepted)
+        std::fprintf(__step_log.get(), "%i %.10e %.10e 0\n", __time_step, __thermo.time,
+            step_length_);
+      std::fprintf(__step_log.get(), "%i %.10e %.10e 1\n", __time_step, __thermo.time, step);
     }
-  }, force1, force2, moment1, moment2, tensor1, tensor2);
+  }
 
-  // principal axis approximation, we don't need precise handle for boundary
-  tensor1 = node_if_rigid1_count_ * CoreMath::Vector(moment1[0]/tensor1[0], 
-      moment1[1]/tensor1[1], moment1[2]/tensor1[2]);
-  tensor2 = node_if_rigid2_count_ * CoreMath::Vector(moment2[0]/tensor2[0], 
-      moment2[1]/tensor2[1], moment2[2]/tensor2[2]);
-  
-  Kokkos::parallel_for(node_positions_.size(), KOKKOS_CLASS_LAMBDA(const int i) {
-    if (node_if_rigid1_(i)) {
-      auto t = node_positions_(i) - center1;
-      node_positions_(i) += (force1 + CoreMath::cross(tensor1, t)) *
-          step_length_ / damp_coeff_;
-    } else if (node_if_rigid2_(i)) {
-      auto t = node_positions_(i) - center2;
-      node_positions_(i) += (force2 + CoreMath::cross(tensor2, t)) *
-          step_length_ / damp_coeff_;
+  __thermo.time += step;
+  __workspace.backup_time_step = __time_step + 1;
+  return step;
+}
+
+void ModelSystem::__rigid_moments() {
+  // sums of a body split by slabs are reduced over all of them
+  auto body = [&](const CoreMath::View<int>& nodes, CoreMath::Vector& center,
+      CoreMath::Vector& diagonal, CoreMath::Vector& off_diagonal) {
+    CoreMath::Vector sum;
+    Kokkos::parallel_reduce(__range(nodes.size()), KOKKOS_CLASS_LAMBDA(const int k,
+        CoreMath::Vector& inner) {
+      inner += node_positions_(nodes(k));
+    }, sum);
+    double sums[4] = {sum[0], sum[1], sum[2], static_cast<double>(nodes.size())};
+    allreduce(sums, 4);
+    auto c = center = CoreMath::Vector(sums[0], sums[1], sums[2]) / sums[3];
+    CoreMath::Vector moments[2];
+    Kokkos::parallel_reduce(__range(nodes.size()), KOKKOS_CLASS_LAMBDA(const int k,
+        CoreMath::Vector& diagonal_inner, CoreMath::Vector& off_diagonal_inner) {
+      __add_second_moment(node_positions_(nodes(k)) - c, diagonal_inner, off_diagonal_inner);
+    }, moments[0], moments[1]);
+    allreduce(&moments[0][0], 6);
+    diagonal = moments[0];
+    off_diagonal = moments[1];
+  };
+  body(rigid_nodes1_, __workspace.center1, __workspace.diagonal1, __workspace.off_diagonal1);
+  body(rigid_nodes2_, __workspace.center2, __workspace.diagonal2, __workspace.off_diagonal2);
+  __workspace.rigid_time_step = __time_step;
+}
+
+void ModelSystem::__update_rigid(double step) {
+  auto& w = __workspace;
+  if (w.rigid_time_step != __time_step || __time_step % kRigidRefresh == 0)
+    __rigid_moments();
+
+  // total force, total moment about center, only rigid nodes are visited
+  auto rigid1 = rigid_nodes1_, rigid2 = rigid_nodes2_;
+  int count1 = rigid1.size(), count2 = rigid2.size();
+  auto center1 = w.center1, center2 = w.center2;
+  RigidReduction reduction;
+  Kokkos::parallel_reduce(__range(count1 + count2), KOKKOS_CLASS_LAMBDA(const int k,
+      RigidReduction& inner) {
+    int b = (k < count1) ? 0 : 1;
+    int i = (b == 0) ? rigid1(k) : rigid2(k - count1);
+    auto force = damp_coeff_ * node_velocities_(i);
+    inner.force[b] += force;
+    inner.moment[b] += CoreMath::cross(node_positions_(i) - ((b == 0) ? center1 : center2),
+        force);
+  }, reduction);
+  // bodies may be split by slabs, their nodes are counted with the reduction
+  double sums[14] = {static_cast<double>(count1), static_cast<double>(count2)};
+  for (int b=0; b<2; b++)
+    for (int d=0; d<3; d++) {
+      sums[2 + 6*b + d] = reduction.force[b][d];
+      sums[5 + 6*b + d] = reduction.moment[b][d];
     }
+  allreduce(sums, 14);
+  w.force1 = CoreMath::Vector(sums[2], sums[3], sums[4]);
+  w.moment1 = CoreMath::Vector(sums[5], sums[6], sums[7]);
+  w.force2 = CoreMath::Vector(sums[8], sums[9], sums[10]);
+  w.moment2 = CoreMath::Vector(sums[11], sums[12], sums[13]);
+
+  auto tensor1 = w.tensor1 = __rigid_tensor(sums[0], w.moment1, w.diagonal1);
+  auto tensor2 = w.tensor2 = __rigid_tensor(sums[1], w.moment2, w.diagonal2);
+
+  // velocities of rigid nodes become the motion of their bodies, then they move
+  auto force1 = w.force1, force2 = w.force2;
+  Kokkos::parallel_for(__range(count1 + count2), KOKKOS_CLASS_LAMBDA(const int k) {
+    bool first = k < count1;
+    int i = first ? rigid1(k) : rigid2(k - count1);
+    node_velocities_(i) = __rigid_velocity(first ? force1 : force2, first ? tensor1 : tensor2,
+        node_positions_(i) - (first ? center1 : center2), damp_coeff_);
+    if (step != 0)
+      node_positions_(i) += node_velocities_(i) * step;
   });
-  
-  __time_step++;
+  node_velocities_.modify<MemorySpace>();
+  if (step == 0)
+    return;
   node_positions_.modify<MemorySpace>();
+
+  __move_rigid(w.center1, w.diagonal1, w.off_diagonal1, force1, tensor1, step, damp_coeff_);
+  __move_rigid(w.center2, w.diagonal2, w.off_diagonal2, force2, tensor2, step, damp_coeff_);
+  w.rigid_time_step = __time_step + 1;
+}
+
+void ModelSystem::__move_interior(double step) {
+  if (step == 0)
+    return;
+  Kokkos::parallel_for(__range(node_positions_.size()), KOKKOS_CLASS_LAMBDA(const int i) {
+    if (!(node_flags_(i) & Metadata::kNodeRigid))
+      node_positions_(i) += node_velocities_(i) * step;
+  });
+  node_positions_.modify<MemorySpace>();
+}
+
+int ModelSystem::minimize(const MinimizeParameters& para) {
+  // parameters suggested by Bitzek et al., Phys. Rev. Lett. 97, 170201 (2006)
+  const int kDelayStep = 5;
+  const double kIncrease = 1.1, kDecrease = 0.5, kAlphaStart = 0.1, kAlphaShrink = 0.99;
+
+  if (__workspace.fire_velocities.extent(0) != node_velocities_.size())
+    resize_workspace();
+  auto velocities = __workspace.fire_velocities;
+  Kokkos::deep_copy(execution_space_, velocities, CoreMath::Vector());
+  // rigid bodies keep their own translational and angular velocities, so that they
+  // are moved by exact rotations and keep their shapes over large steps
+  CoreMath::Vector velocity1, angular1, velocity2, angular2;
+
+  double dt = step_length_, dt_max = 10 * step_length_, alpha = kAlphaStart;
+  double last_energy = 0;
+  int positive_step = 0, step = 0;
+  for (; step < para.max_steps; step++) {
+    bool thermo = thermo_every_ > 0 && __time_step % thermo_every_ == 0;
+    // forces (as velocities of overdamped motion) with rigid projection, no move
+    __update_velocities(false, true, thermo);
+    __update_rigid(0);
+    double energy = __thermo.bond1_energy + __thermo.bond2_energy + __thermo.curvature_energy;
+    auto center1 = __workspace.center1, center2 = __workspace.center2;
+
+    // power, norms of inertial velocities and forces, largest force
+    double power = 0, velocity_norm2 = 0, force_norm2 = 0, max_force2 = 0;
+    Kokkos::parallel_reduce(__range(node_velocities_.size()), KOKKOS_CLASS_LAMBDA(const int i,
+        double& power_inner, double& velocity_inner, double& force_inner,
+        double& max_force_inner) {
+      CoreMath::Vector force = node_velocities_(i);
+      auto velocity = velocities(i);
+      auto flag = node_flags_(i);
+      if (flag & Metadata::kNodeGhost)
+        return;
+      if (flag & Metadata::kNodeRigid1)
+        velocity = velocity1 + CoreMath::cross(angular1, node_positions_(i) - center1);
+      else if (flag & Metadata::kNodeRigid2)
+        velocity = velocity2 + CoreMath::cross(angular2, node_positions_(i) - center2);
+      power_inner += velocity * force;
+      velocity_inner += velocity * velocity;
+      force_inner += force * force;
+      max_force_inner = (force * force > max_force_inner) ? force * force : max_force_inner;
+    }, power, velocity_norm2, force_norm2, Kokkos::Max<double>(max_force2));
+    double sums[3] = {power, velocity_norm2, force_norm2};
+    allreduce(sums, 3);
+    allreduce(&max_force2, 1, true);
+    power = sums[0];
+    velocity_norm2 = sums[1];
+    force_norm2 = sums[2];
+
+    if (thermo) {
+      __thermo.time_step = __time_step;
+      __thermo.force1 = __workspace.force1;
+      __thermo.moment1 = __workspace.moment1;
+      __thermo.force2 = __workspace.force2;
+      __thermo.moment2 = __workspace.moment2;
+      __print_thermo();
+    }
+
+    // forces here are divided by damp_coeff_
+    if (Kokkos::sqrt(max_force2) * damp_coeff_ < para.force_tol)
+      break;
+    if (step != 0 && para.energy_tol != 0 &&
+        Kokkos::fabs(energy - last_energy) <= para.energy_tol * Kokkos::fabs(energy))
+      break;
+    last_energy = energy;
+
+    // mix velocities towards forces while going downhill, otherwise stop and restart
+    double mix = 0, keep = 1;
+    if (power > 0) {
+      mix = alpha * Kokkos::sqrt(velocity_norm2 / force_norm2);
+      keep = 1 - alpha;
+      if (++positive_step > kDelayStep) {
+        dt = Kokkos::fmin(dt * kIncrease, dt_max);
+        alpha *= kAlphaShrink;
+      }
+    } else {
+      keep = 0;
+      positive_step = 0;
+      dt *= kDecrease;
+      alpha = kAlphaStart;
+    }
+    // forces of rigid nodes are (force + tensor x t) / damp_coeff_ from __update_rigid
+    velocity1 = keep * velocity1 + (mix + dt) / damp_coeff_ * __workspace.force1;
+    angular1 = keep * angular1 + (mix + dt) / damp_coeff_ * __workspace.tensor1;
+    velocity2 = keep * velocity2 + (mix + dt) / damp_coeff_ * __workspace.force2;
+    angular2 = keep * angular2 + (mix + dt) / damp_coeff_ * __workspace.tensor2;
+
+    double max_velocity2 = 0;
+    Kokkos::parallel_reduce(__range(node_velocities_.size()), KOKKOS_CLASS_LAMBDA(const int i,
+        double& max_velocity_inner) {
+      CoreMath::Vector velocity;
+      auto flag = node_flags_(i);
+      if (flag & Metadata::kNodeRigid1) {
+        velocity = velocity1 + CoreMath::cross(angular1, node_positions_(i) - center1);
+      } else if (flag & Metadata::kNodeRigid2) {
+        velocity = velocity2 + CoreMath::cross(angular2, node_positions_(i) - center2);
+      } else {
+        CoreMath::Vector force = node_velocities_(i);
+        velocities(i) = keep * velocities(i) + (mix + dt) * force;
+        velocity = velocities(i);
+      }
+      double velocity_norm2 = velocity * velocity;
+      if (!(flag & Metadata::kNodeGhost))
+        max_velocity_inner = (velocity_norm2 > max_velocity_inner) ?
+            velocity_norm2 : max_velocity_inner;
+    }, Kokkos::Max<double>(max_velocity2));
+    allreduce(&max_velocity2, 1, true);
+
+    // limit the largest displacement, the whole step is scaled to keep its direction
+    double move = dt;
+    if (Kokkos::sqrt(max_velocity2) * dt > para.max_move)
+      move = para.max_move / Kokkos::sqrt(max_velocity2);
+    Kokkos::parallel_for(__range(node_positions_.size()), KOKKOS_CLASS_LAMBDA(const int i) {
+      auto flag = node_flags_(i);
+      if (flag & Metadata::kNodeRigid1)
+        node_positions_(i) = center1 + velocity1 * move +
+            CoreMath::rotate(node_positions_(i) - center1, angular1 * move);
+      else if (flag & Metadata::kNodeRigid2)
+        node_positions_(i) = center2 + velocity2 * move +
+            CoreMath::rotate(node_positions_(i) - center2, angular2 * move);
+      else
+        node_positions_(i) += velocities(i) * move;
+    });
+    node_positions_.modify<MemorySpace>();
+    __exchange_halo();
+    __time_step++;
+  }
+  execution_space_.fence();
+  return step;
+}
+
+void ModelSystem::allreduce(double* values, int count, bool max) const {
+#ifdef QUADRATUBE_MPI
+  if (__decomposition != nullptr)
+    __decomposition->allreduce(values, count, max);
+#endif
+}
+
+void ModelSystem::__exchange_halo() {
+#ifdef QUADRATUBE_MPI
+  if (__decomposition != nullptr)
+    __decomposition->exchange_halo();
+#endif
+}
+
+void ModelSystem::__print_thermo() const {
+#ifdef QUADRATUBE_MPI
+  // every slab has the same thermo after reductions, the first one prints
+  if (__decomposition != nullptr && __decomposition->rank() != 0)
+    return;
+#endif
+  std::printf("step %i:", __thermo.time_step);
+  if (DUMP_CHECK(Metadata::kThermoEnergy, thermo_type_))
+    std::printf(" epot %.8f (bond1 %.8f, bond2 %.8f, curvature %.8f)",
+        __thermo.bond1_energy + __thermo.bond2_energy + __thermo.curvature_energy,
+        __thermo.bond1_energy, __thermo.bond2_energy, __thermo.curvature_energy);
+  if (DUMP_CHECK(Metadata::kThermoMaxForce, thermo_type_))
+    std::printf(" fmax %.8e", __thermo.max_force);
+  if (DUMP_CHECK(Metadata::kThermoVelocity, thermo_type_))
+    std::printf(" vrms %.8e", __thermo.rms_velocity);
+  if (DUMP_CHECK(Metadata::kThermoRigid, thermo_type_))
+    std::printf(" rigid1 f (%.4e, %.4e, %.4e) m (%.4e, %.4e, %.4e)"
+        " rigid2 f (%.4e, %.4e, %.4e) m (%.4e, %.4e, %.4e)",
+        __thermo.force1[0], __thermo.force1[1], __thermo.force1[2],
+        __thermo.moment1[0], __thermo.moment1[1], __thermo.moment1[2],
+        __thermo.force2[0], __thermo.force2[1], __thermo.force2[2],
+        __thermo.moment2[0], __thermo.moment2[1], __thermo.moment2[2]);
+  if (adaptive_step_.enable)
+    std::printf(" dt %.4e time %.6e steps %i rejected %i", __thermo.step_length,
+        __thermo.time, __thermo.accepted, __thermo.rejected);
+  std::printf("\n");
 }
@@ -10,11 +10,19 @@
 #ifndef QUADRATUBE_MODEL_SYSTEM_H_
 #define QUADRATUBE_MODEL_SYSTEM_H_
 
+#include <cstdio>
+#include <memory>
 #include <string>
 
 #include "metadata.h"
 #include "core/math.h"
 
+namespace UtilsWriter {
+class AsyncWriter;
+} // namespace UtilsWriter
+
+class ModelDecomposition;
+
 /**
  * @class System
  * @brief Molecular system
@@ -22,6 +30,11 @@
  * 
  */
 class ModelSystem : public Metadata::EnergyMetaData {
+  /// @brief packs replicas and hands their time step and thermo back
+  friend class ModelEnsemble;
+  /// @brief builds slabs from a whole system and exchanges their halos
+  friend class ModelDecomposition;
+
   public:
     /// @brief transform index of others to relative positions
     /// @details "h" is for host, "d" is for device
@@ -41,67 +54,454 @@ class ModelSystem : public Metadata::EnergyMetaData {
         node_positions_[others[0]]-node_positions_[center], 
         node_positions_[others[1]]-node_positions_[center]);
     }
+    /// @brief relative positions are subtracted in double and stored in Real, as
+    ///     arguments of energy kernels
     KOKKOS_INLINE_FUNCTION
-    CoreMath::Array<CoreMath::Vector> d_get_positions(int center, 
+    CoreMath::Array<CoreMath::RealVector> d_get_positions(int center, 
         const CoreMath::Array<int>& others) const {
-      CoreMath::Array<CoreMath::Vector> result(others.size());
+      CoreMath::Array<CoreMath::RealVector> result(others.size());
       for (int i=0; i<others.size(); i++)
-        result[i] = node_positions_(others[i])-node_positions_(center);
+        result[i] = CoreMath::RealVector(node_positions_(others[i])-node_positions_(center));
       return result;
     }
     KOKKOS_INLINE_FUNCTION
-    CoreMath::Pair<CoreMath::Vector> d_get_positions(int center, 
+    CoreMath::Array<CoreMath::RealVector> d_get_positions(int center, 
+        const CoreMath::Csr::Row& others) const {
+      return __relative_positions(node_positions_, center, others);
+    }
+    KOKKOS_INLINE_FUNCTION
+    CoreMath::Pair<CoreMath::RealVector> d_get_positions(int center, 
         const CoreMath::Pair<int>& others) const {
-      return CoreMath::Pair<CoreMath::Vector>(
-        node_positions_(others[0])-node_positions_(center), 
-        node_positions_(others[1])-node_positions_(center));
+      return CoreMath::Pair<CoreMath::RealVector>(
+        CoreMath::RealVector(node_positions_(others[0])-node_positions_(center)), 
+        CoreMath::RealVector(node_positions_(others[1])-node_positions_(center)));
     }
     
     /// @brief alias of default memory and host mirrorspace
     using MemorySpace = CoreMath::View<int>::MemorySpace;
     using HostMirrorSpace = CoreMath::View<int>::HostMirrorSpace;
+    /// @brief kernels of the system run on execution_space_, the default instance,
+    ///     or a partition of it when several systems run concurrently (UtilsSweep)
+    using ExecutionSpace = Kokkos::DefaultExecutionSpace;
+    ExecutionSpace execution_space_;
 
+    /// @brief with kDumpAsync, a snapshot is copied and written by a background
+    ///     thread, so update can continue immediately. Flags, ids and bonds are
+    ///     those at the time of dump, even if load() or reorder() follows
     void dump(std::string file_name, Metadata::DumpType dump_type);
+    /// @brief binary checkpoint of every view, counts, time step, parameters and
+    ///     random state. Parameters set before load will be overwritten. The state of
+    ///     adaptive step (time, counts, backups of the last step) is stored too, so
+    ///     that an adaptive run restarts exactly; a ModelDecomposition gathers no
+    ///     backups, and its first step after a restart isn't checked.
     void store(std::string file_name);
     void load(std::string file_name);
     void update(bool just_velocity = false);
 
+    /**
+     * @brief Adaptive step of update
+     * @details step_length_ becomes the current step, chosen from the largest
+     *     velocity so that no node moves more than max_move. The change of forces
+     *     between steps is checked with the next force evaluation, and a step
+     *     changing displacements more than max_change is rolled back and redone with
+     *     half step. Positions changed outside update invalidate the check only if
+     *     resize_workspace() is called.
+     */
+    struct AdaptiveStep {
+      bool enable = false;
+      double max_move = 1e-2;    ///< largest displacement of a node in one step
+      double max_change = 5e-3;  ///< largest change of displacement between steps
+      double min_step = 1e-5, max_step = 1e-1;
+      double growth = 1.2;       ///< largest growth of step between steps
+      /// step that the amplitude of random forces is meant for, they are scaled by
+      /// sqrt(noise_step/step) so that nodes diffuse at the same rate whatever the
+      /// step is. 0 takes step_length_ when adaptation starts
+      double noise_step = 0;
+      std::string log_file;      ///< "time_step time step taken(1)/rolled back(0)"
+    } adaptive_step_;
+
+    /// @brief stopping criteria and step control of minimize
+    struct MinimizeParameters {
+      double force_tol = 1e-6;  ///< max |force| of nodes, rigid ones by motion of bodies
+      double energy_tol = 0;    ///< relative change of energy in one step, 0 to disable
+      int max_steps = 100000;
+      double max_move = 0.1;    ///< max displacement of a node in one step
+    };
+    /// @brief relax to the nearest energy minimum by FIRE, with the same forces and
+    ///     rigid-end treatment as update. Temperature is ignored, step_length_ is
+    ///     the initial time step and a tenth of the largest one.
+    /// @return steps used, every step counts as a time step
+    int minimize(const MinimizeParameters& para);
+
+    /// @brief integrate interior nodes inside the force kernels of update, two
+    ///     sweeps of all nodes instead of three. Ignored when adaptive step is enabled.
+    bool fused_step_ = false;
+    /// @brief total forces and moments (about centers) of both rigid bodies, reduced
+    ///     over rigid nodes only
+    struct RigidReduction {
+      CoreMath::Vector force[2], moment[2];
+      KOKKOS_INLINE_FUNCTION
+      RigidReduction& operator+=(const RigidReduction& p) {
+        for (int b=0; b<2; b++) {
+          force[b] += p.force[b];
+          moment[b] += p.moment[b];
+        }
+        return *this;
+      }
+    };
+
+    /**
+     * @brief How forces of bonds are accumulated by update
+     * @details kBondGather evaluates every bond from both nodes and is deterministic.
+     *     kBondAtomic and kBondColored evaluate every bond once and add it to both
+     *     nodes, by atomic operations or by batches of bonds sharing no node.
+     */
+    enum BondScheme { kBondGather, kBondAtomic, kBondColored };
+    BondScheme bond_scheme_ = kBondGather;
+    /**
+     * @brief How gradients of curvature energy are accumulated by update
+     * @details kCurvatureGather stores gradients of every node and gathers them by
+     *     a second pass, deterministic. kCurvatureColored adds them to nodes
+     *     directly, batch by batch of nodes sharing no curvature adjacent, without
+     *     the buffer of gradients. kCurvatureBatch is kCurvatureGather with gradients
+     *     evaluated for CoreMath::RealSimd::size() nodes of the same degree at once,
+     *     one node per SIMD lane.
+     */
+    enum CurvatureScheme { kCurvatureGather, kCurvatureColored, kCurvatureBatch };
+    CurvatureScheme curvature_scheme_ = kCurvatureGather;
+
+    /// @brief renumber nodes by reverse Cuthill-McKee on their adjacents, so that
+    ///     neighbours are close in memory. Every per-node view and relation is
+    ///     permuted, original ids are kept in node_ids_ for dump. Call after
+    ///     construction, on host.
+    void reorder();
+
+    /// @brief rebuild compressed adjacents and (re)allocate temporaries of update,
+    ///     call after topology changes
+    void resize_workspace();
+    /// @brief memory used by temporaries of update, and by compressed adjacents
+    ///     read by kernels, in bytes
+    size_t workspace_bytes() const;
+    size_t topology_bytes() const;
+
     /// @brief Random number pool
     CoreMath::Pool rand_pool_;
 
+    /// @brief print thermo every thermo_every_ steps (0 for never), items are
+    ///     selected by thermo_type_, reduced inside force kernels of update
+    int thermo_every_ = 0;
+    Metadata::ThermoType thermo_type_ = Metadata::kThermoAll;
+
+    /// @brief observables of the last thermo step
+    struct Thermo {
+      int time_step = 0;
+      double bond1_energy = 0, bond2_energy = 0, curvature_energy = 0;
+      /// @brief max |force| of non-rigid nodes, root mean square of their velocities
+      double max_force = 0, rms_velocity = 0;
+      /// @brief total force and moment of rigid ends
+      CoreMath::Vector force1, moment1, force2, moment2;
+      /// @brief current step, time and counts of steps since adaptive step enabled
+      double step_length = 0, time = 0;
+      int accepted = 0, rejected = 0;
+    };
+    inline const Thermo& thermo() const { return __thermo; }
+
+    /// @brief sums (or maxima) of values over every slab of a ModelDecomposition, in
+    ///     place and collective. Nothing happens for a whole system.
+    void allreduce(double* values, int count, bool max = false) const;
+
   // Data which will be store and load
   public:
-    /// @brief These are used in calculate
-    CoreMath::View<CoreMath::Vector> node_positions_;  
-    CoreMath::View<CoreMath::Vector> node_velocities_;
+    /// @brief These are used in calculate, layout is chosen by CoreMath::NodeLayout
+    CoreMath::VectorView node_positions_;  
+    CoreMath::VectorView node_velocities_;
 
-    // These won't be changed during update, and won't be checked by update or store.
+    // These won't be changed during update, and won't be checked by update.
 
-    /// @brief Adjacents of nodes
-    CoreMath::View<CoreMath::Array<int>> node_adjacents_bonds1_;
-    CoreMath::View<CoreMath::Array<int>> node_adjacents_bonds2_;
-    CoreMath::View<CoreMath::Array<int>> node_adjacents_curvature_;
+    /// @brief Adjacents of nodes, only on host. They are what initializer edits and
+    ///     checkpoints store, kernels read the CSR built from them. A node still has
+    ///     at most CoreMath::Array<int>::capacity() adjacents of each kind.
+    CoreMath::HostView<CoreMath::Array<int>> node_adjacents_bonds1_;
+    CoreMath::HostView<CoreMath::Array<int>> node_adjacents_bonds2_;
+    CoreMath::HostView<CoreMath::Array<int>> node_adjacents_curvature_;
 
+    /// @brief Flags of nodes (Metadata::kNodeEmphasis, kNodeRigid1, ...), one
+    ///     byte per node so that every check is a single load.
+    CoreMath::View<Metadata::NodeFlag> node_flags_;
+    /// @brief Original id of nodes written by dump, empty if nodes are never reordered.
+    CoreMath::View<int> node_ids_;
     /// @brief Nodes of dislocations, have different types when output.
-    CoreMath::View<bool> node_if_emphasis_;
     int node_if_emphasis_count_ = 0;
-
-    /// @brief Nodes regards like rigid body, for edge processing.
-    CoreMath::View<bool> node_if_rigid1_;
+    /// @brief Nodes regards like rigid body, for edge processing. Indices of rigid
+    ///     ones are in rigid_nodes1_ and rigid_nodes2_.
     int node_if_rigid1_count_ = 0;
-    CoreMath::View<bool> node_if_next_to_rigid1_;
     int node_if_next_to_rigid1_count_ = 0;
-    CoreMath::View<bool> node_if_rigid2_;
     int node_if_rigid2_count_ = 0;
-    CoreMath::View<bool> node_if_next_to_rigid2_;
     int node_if_next_to_rigid2_count_ = 0;
 
     /// @brief These are used just for output, bonds and bond types
     CoreMath::View<CoreMath::Pair<int>> bond_relations1_;
     CoreMath::View<CoreMath::Pair<int>> bond_relations2_;
+
+  // Derived from data above, won't be stored
+  public:
+    /// @brief Compressed adjacents (CSR) built from adjacents, read by kernels
+    ///     instead of the lists. Rebuilt by resize_workspace().
+    CoreMath::Csr csr_bonds1_, csr_bonds2_, csr_curvature_;
+    /// @brief For the k-th entry of csr_curvature_ (node i and its adjacent a), the
+    ///     entry of i in the row of a. The only table of reverse slots.
+    CoreMath::View<int> csr_curvature_reverse_;
+    /// @brief Adjacents and bonds with forces, rigid-rigid bonds are excluded since
+    ///     rigid bodies move as a whole. Bonds of color c are
+    ///     [force_bond_colors[c], force_bond_colors[c+1]) and share no node.
+    CoreMath::Csr csr_force_bonds1_, csr_force_bonds2_;
+    CoreMath::View<CoreMath::Pair<int>> force_bonds1_, force_bonds2_;
+    CoreMath::View<int> force_bond_colors1_, force_bond_colors2_;
+    /// @brief Nodes with curvature forces (not next to rigid) in groups, group g is
+    ///     [curvature_groups_[g], curvature_groups_[g+1]). Groups are colors for
+    ///     kCurvatureColored, whose nodes are neither adjacent nor sharing an
+    ///     adjacent, and lanes for kCurvatureBatch, whose nodes have the same degree.
+    ///     Empty for kCurvatureGather.
+    CoreMath::View<int> curvature_nodes_, curvature_groups_;
+    /// @brief Ascending indices of nodes with kNodeRigid1 and kNodeRigid2, so that
+    ///     rigid bodies cost as much as their rings, not the whole tube. Nodes next
+    ///     to them only lose curvature forces, which kernels check by kNodeNearRigid.
+    CoreMath::View<int> rigid_nodes1_, rigid_nodes2_;
+    /// @brief streams of random forces, indices of nodes in the whole system for a
+    ///     slab of ModelDecomposition, empty if nodes are their own streams
+    CoreMath::View<int> node_streams_;
   
   private:
     int __time_step = 0;
+
+    /// @brief range of a kernel on execution_space_
+    inline Kokkos::RangePolicy<ExecutionSpace> __range(size_t begin, size_t end) const {
+      return Kokkos::RangePolicy<ExecutionSpace>(execution_space_, begin, end);
+    }
+    inline Kokkos::RangePolicy<ExecutionSpace> __range(size_t n) const {
+      return __range(0, n);
+    }
+
+    Thermo __thermo;
+    void __print_thermo() const;
+
+    /// @brief decomposition this system is a slab of, null for a whole system. Ghost
+    ///     nodes (Metadata::kNodeGhost) are refreshed by __exchange_halo() after every
+    ///     move, and are left out of thermo and rigid bodies.
+    ModelDecomposition* __decomposition = nullptr;
+    void __exchange_halo();
+
+    /// @brief velocities of overdamped motion -grad/damp, noises are added when
+    ///     thermal. Energies and motion observables are reduced into __thermo if asked.
+    ///     If fused, interior nodes also move by step_length_. Dispatched to the
+    ///     instance of the EnergyPolicy of lattice_.
+    void __update_velocities(bool thermal, bool thermo_energy, bool thermo_motion,
+        bool fused = false);
+    template <typename Policy>
+    void __update_velocities(bool thermal, bool thermo_energy, bool thermo_motion,
+        bool fused);
+    /// @brief add forces of bonds to velocities bond by bond, for kBondAtomic and
+    ///     kBondColored
+    template <typename Policy>
+    void __scatter_bonds();
+    /// @brief add gradients of curvature to velocities color by color, for
+    ///     kCurvatureColored
+    void __scatter_curvature();
+    /// @brief store gradients of curvature group by group in SIMD lanes, for
+    ///     kCurvatureBatch
+    void __batch_curvature();
+    /// @brief size of Workspace::gradients needed by curvature_scheme_
+    inline size_t __gradients_size() const {
+      return (curvature_scheme_ == kCurvatureColored) ? 0 : csr_curvature_.entries();
+    }
+    /// @brief choose step for adaptive step, or roll back last step if rejected
+    double __adapt_step();
+    std::shared_ptr<std::FILE> __step_log;
+
+    /**
+     * @brief Solver of rigid bodies
+     * @details Velocities of rigid nodes are replaced by the motion of their bodies,
+     *     and rigid nodes move by velocity * step. Only rigid nodes are visited.
+     *     Centers and second moments follow the motion incrementally, they are
+     *     recomputed when they don't belong to the current time step (load, roll
+     *     back, minimize) and every kRigidRefresh steps against rounding.
+     */
+    void __update_rigid(double step);
+    void __rigid_moments();
+    static const int kRigidRefresh = 1000;
+    /// @brief non-rigid nodes move by velocity * step
+    void __move_interior(double step);
+
+    /**
+     * @brief Bodies of update for one node or one rigid body, shared with ModelEnsemble
+     * @details Energy functions are read through para, which is this system (pair
+     *     tables included) for update, or the analytic parameters of a replica for
+     *     ModelEnsemble. Anything with bond1_, bond2_ and curvature_ energy and
+     *     gradient functions of Metadata::EnergyMetaData works.
+     */
+    /// @brief relative positions in Real, see d_get_positions
+    KOKKOS_INLINE_FUNCTION
+    static CoreMath::Array<CoreMath::RealVector> __relative_positions(
+        const CoreMath::VectorView& positions, int center, const CoreMath::Csr::Row& others) {
+      CoreMath::Array<CoreMath::RealVector> result(others.size());
+      for (int i=0; i<others.size(); i++)
+        result[i] = CoreMath::RealVector(positions(others[i]) - positions(center));
+      return result;
+    }
+    /// @brief gradients of the curvature of a node with respect to its adjacents into
+    ///     gradients from offset, zero if it's near rigid ends
+    template <typename Para>
+    KOKKOS_INLINE_FUNCTION
+    static void __curvature_gradients(const Para& para,
+        const CoreMath::Array<CoreMath::RealVector>& others, bool near_rigid,
+        const Kokkos::View<CoreMath::RealVector*>& gradients, int offset) {
+      if (!near_rigid) {
+        auto gradient = para.curvature_gradient(others);
+        for (int j=0; j<others.size(); j++)
+          gradients(offset + j) = gradient[j];
+      } else {
+        for (int j=0; j<others.size(); j++)
+          gradients(offset + j) = CoreMath::RealVector();
+      }
+    }
+    /// @brief energies of bonds of node i, half of every bond
+    template <typename Policy, typename Para>
+    KOKKOS_INLINE_FUNCTION
+    static void __bond_energies(const Para& para, const CoreMath::VectorView& positions,
+        int i, const CoreMath::Csr::Row& bonds1, const CoreMath::Csr::Row& bonds2,
+        double& energy1, double& energy2) {
+      for (auto j : __relative_positions(positions, i, bonds1))
+        energy1 += para.bond1_energy(j) / 2;
+      if constexpr (Policy::kBond2)
+        for (auto j : __relative_positions(positions, i, bonds2))
+          energy2 += para.bond2_energy(j) / 2;
+    }
+    /// @brief total force of bonds with forces of node i, -div() of them
+    template <typename Policy, typename Para>
+    KOKKOS_INLINE_FUNCTION
+    static CoreMath::Vector __bond_forces(const Para& para,
+        const CoreMath::VectorView& positions, int i, const CoreMath::Csr::Row& force_bonds1,
+        const CoreMath::Csr::Row& force_bonds2) {
+      CoreMath::Vector reduced;
+      for (auto j : __relative_positions(positions, i, force_bonds1))
+        reduced += para.bond1_gradient(j);
+      if constexpr (Policy::kBond2)
+        for (auto j : __relative_positions(positions, i, force_bonds2))
+          reduced += para.bond2_gradient(j);
+      return reduced;
+    }
+    /// @brief force of curvature on a node whose entries are [begin, end): gradients
+    ///     of its own curvature, and those of its adjacents located by reverse
+    KOKKOS_INLINE_FUNCTION
+    static CoreMath::Vector __gather_curvature(
+        const Kokkos::View<CoreMath::RealVector*>& gradients,
+        const CoreMath::View<int>& reverse, int begin, int end) {
+      CoreMath::Vector reduced;
+      for (int k=begin; k<end; k++)
+        reduced += gradients(k);
+      for (int k=begin; k<end; k++)
+        reduced += -gradients(reverse(k));
+      return reduced;
+    }
+    /// @brief second moments t t^T of a node at t from the center, added into
+    ///     diagonal (xx, yy, zz) and off diagonal (yz, xz, xy)
+    KOKKOS_INLINE_FUNCTION
+    static void __add_second_moment(const CoreMath::Vector& t, CoreMath::Vector& diagonal,
+        CoreMath::Vector& off_diagonal) {
+      diagonal += CoreMath::Vector(t[0]*t[0], t[1]*t[1], t[2]*t[2]);
+      off_diagonal += CoreMath::Vector(t[1]*t[2], t[0]*t[2], t[0]*t[1]);
+    }
+    /// @brief angular velocity of a body of count nodes by the principal axis
+    ///     approximation, we don't need precise handle for boundary
+    KOKKOS_INLINE_FUNCTION
+    static CoreMath::Vector __rigid_tensor(double count, const CoreMath::Vector& moment,
+        const CoreMath::Vector& d) {
+      return count * CoreMath::Vector(moment[0]/(d[1]+d[2]), moment[1]/(d[0]+d[2]),
+          moment[2]/(d[0]+d[1]));
+    }
+    /// @brief velocity of a rigid node at t from the center of its body
+    KOKKOS_INLINE_FUNCTION
+    static CoreMath::Vector __rigid_velocity(const CoreMath::Vector& force,
+        const CoreMath::Vector& tensor, const CoreMath::Vector& t, double damp_coeff) {
+      return (force + CoreMath::cross(tensor, t)) / damp_coeff;
+    }
+    /// @brief the body follows its nodes: t becomes (1 + step/damp [tensor]x) t
+    KOKKOS_INLINE_FUNCTION
+    static void __move_rigid(CoreMath::Vector& center, CoreMath::Vector& diagonal,
+        CoreMath::Vector& off_diagonal, const CoreMath::Vector& force,
+        const CoreMath::Vector& tensor, double step, double damp_coeff) {
+      double h = step / damp_coeff;
+      center += h * force;
+      CoreMath::transform_second_moment(diagonal, off_diagonal, tensor, h);
+    }
+
+    /// @brief background writer of dump, created by the first asynchronous dump
+    std::shared_ptr<UtilsWriter::AsyncWriter> __writer;
+
+    /// @brief apply f(name, view) on every view of store and load, in file order
+    template <typename F>
+    void __for_each_view(F f) {
+      f("node_positions", node_positions_);
+      f("node_velocities", node_velocities_);
+      f("node_adjacents_bonds1", node_adjacents_bonds1_);
+      f("node_adjacents_bonds2", node_adjacents_bonds2_);
+      f("node_adjacents_curvature", node_adjacents_curvature_);
+      f("node_flags", node_flags_);
+      f("node_ids", node_ids_);
+      f("bond_relations1", bond_relations1_);
+      f("bond_relations2", bond_relations2_);
+    }
+
+    /**
+     * @brief Temporaries of update
+     * @details Owned by system so that a steady-state step allocates nothing. Sized
+     *     by resize_workspace() after init or load, and checked against node numbers
+     *     at the beginning of every update.
+     */
+    struct Workspace {
+      /// @brief gradients of curvature in Real, one per entry of csr_curvature_, only
+      ///     for kCurvatureGather and kCurvatureBatch
+      Kokkos::View<CoreMath::RealVector*> gradients;
+      /// @brief scheme which curvature groups and gradients are built for
+      CurvatureScheme curvature_scheme = kCurvatureGather;
+      /// @brief random forces, only filled when temperature isn't 0
+      Kokkos::View<CoreMath::Vector*> noises;
+      /// @brief center of mass, inertia tensor, total force, total moment of rigid bodies
+      CoreMath::Vector center1, tensor1, force1, moment1;
+      CoreMath::Vector center2, tensor2, force2, moment2;
+      /// @brief second moments sum t t^T about centers, diagonal (xx, yy, zz) and off
+      ///     diagonal (yz, xz, xy)
+      CoreMath::Vector diagonal1, off_diagonal1, diagonal2, off_diagonal2;
+      /// @brief time step centers and second moments belong to, -1 if invalid
+      int rigid_time_step = -1;
+      /// @brief owned nodes that aren't rigid, the denominator of rms velocity
+      int free_nodes = 0;
+      /// @brief state before the last adaptive step, and deterministic velocities
+      ///     (without noise) of this and last step, only allocated by adaptive step
+      CoreMath::VectorView::t_dev backup_positions, backup_velocities;
+      Kokkos::View<CoreMath::Vector*> forces, last_forces;
+      /// @brief time step the backup leads to, -1 if there's no valid backup
+      int backup_time_step = -1;
+      /// @brief inertial velocities of FIRE, sized with the rest so that minimize
+      ///     allocates nothing
+      Kokkos::View<CoreMath::Vector*> fire_velocities;
+      /// @brief custom columns of dump, column major, only reallocated by dump
+      CoreMath::View<double> columns;
+    } __workspace;
+
+    /// @brief evaluate custom columns of dump on device into workspace
+    CoreMath::View<double>& __evaluate_columns(Metadata::DumpType dump_type);
 }; // class ModelSystem
 
+// reduction identity of RigidReduction, must be defined in Kokkos namespace
+namespace Kokkos {
+template<>
+struct reduction_identity<ModelSystem::RigidReduction> {
+  KOKKOS_FORCEINLINE_FUNCTION
+  static ModelSystem::RigidReduction sum() {
+    return ModelSystem::RigidReduction();
+  }
+};
+} // namespace Kokkos
+
 #endif // QUADRATUBE_MODEL_SYSTEM_H_
@@ -16,6 +16,17 @@
 
 #include "core/math.h"
 #include "core/energy.h"
+#include "model/ensemble.h"
+#include "model/initializer.h"
+#include "model/system.h"
+#include "utils/sweep.h"
+#include "utils/trajectory.h"
+
+#ifdef QUADRATUBE_MPI
+#include <mpi.h>
+
+#include "model/decomposition.h"
+#endif
 
 /// @brief example adjacents for check
 /// @return
@@ -148,4 +159,610 @@ void test_parallel() {
   }
   delete []result;
   } Kokkos::finalize();
-}
\ No newline at end of file
+}
+
+/**
+ * @test write frames of binary trajectory and read them back, also after appends
+ *     interrupted before and during writing the index
+ */
+void test_trajectory() {
+  const char* file_name = "test_trajectory.traj";
+  const int atoms = 5;
+  UtilsTrajectory::Topology topology = {std::vector<int32_t>(atoms, 1),
+    {CoreMath::Pair<int>(0, 1), CoreMath::Pair<int>(1, 2)}, {}, {0, 1, 0, 1, 0, 1},
+    {"g_curv"}, 2.5};
+  std::vector<CoreMath::Vector> positions(atoms);
+  std::vector<double> columns(atoms);
+  auto append = [&](int k) {
+    for (int i=0; i<atoms; i++) {
+      positions[i] = CoreMath::Vector(k, i, k*i);
+      columns[i] = k + 0.5*i;
+    }
+    UtilsTrajectory::append(file_name, topology, k, atoms, positions.data(), nullptr,
+        columns.data());
+  };
+  auto read = [&]() {
+    std::string content;
+    FILE *file = std::fopen(file_name, "rb");
+    for (int c; (c = std::fgetc(file)) != EOF; )
+      content.push_back(c);
+    std::fclose(file);
+    return content;
+  };
+  auto write = [&](const std::string& content) {
+    FILE *file = std::fopen(file_name, "wb");
+    std::fwrite(content.data(), 1, content.size(), file);
+    std::fclose(file);
+  };
+  auto check = [&](const char* name, size_t frames) {
+    UtilsTrajectory::Reader reader(file_name);
+    int errors = (!reader.good() || reader.frames() != frames ||
+        reader.header().mass != topology.mass || reader.velocities(0) != nullptr);
+    for (size_t k=0; !errors && k<frames; k++) {
+      errors += reader.time_step(k) != k;
+      for (int i=0; i<atoms; i++)
+        errors += reader.positions(k)[3*i] != k || reader.positions(k)[3*i+1] != i ||
+            reader.positions(k)[3*i+2] != k*i || reader.column(k, 0)[i] != k + 0.5*i;
+    }
+    std::printf("%s: \t%zu frames%s \t%s\n", name, reader.frames(),
+        reader.recovered() ? " (recovered)" : "", errors ? "failed" : "passed");
+  };
+
+  for (int k=0; k<4; k++)
+    append(k);
+  check("intact", 4);
+  std::string four = read();
+  append(4);
+  std::string five = read();
+  // frames are back to back, the index (8 bytes per frame) and trailer follow them
+  size_t trailer = 24, width = five.size() - four.size() - 8;
+  size_t end = four.size() - 4*8 - trailer;
+
+  // crashed after the 5th frame, before its index
+  write(five.substr(0, end + width));
+  check("without index", 5);
+  // crashed at the beginning of the 5th frame, the rest of old index is left
+  write(five.substr(0, end + 16) + four.substr(end + 16));
+  check("broken frame", 4);
+  // the next append writes over the broken frame
+  append(4);
+  check("appended again", 5);
+  std::remove(file_name);
+}
+
+/// @brief the triangular 13-11 tube of main with a dislocation pair, for tests
+void test_tube(ModelSystem& system, double rigidity = 0.1, int repeat = 8) {
+  system.bond2_spring_constant_ = 1;
+  system.curvature_bending_rigidity_ = rigidity;
+  ModelInitializer::Initializer initializer(system);
+  ModelInitializer::Parameters parameters = {
+    .m = 13, .n = 11, .repeat = repeat, .direction = -1, .glide = 5, .climb = 0,
+    .rest_len = 1, .reorder = true
+  };
+  initializer.init(parameters);
+}
+
+/// @brief seconds of f between fences, so kernels it launches are finished
+template <typename F>
+double test_seconds(F f) {
+  Kokkos::fence();
+  auto t1 = std::chrono::high_resolution_clock::now();
+  f();
+  Kokkos::fence();
+  auto t2 = std::chrono::high_resolution_clock::now();
+  return std::chrono::duration<double>(t2 - t1).count();
+}
+
+/// @brief largest difference of positions between two systems of the same tube
+double test_difference(ModelSystem& a, ModelSystem& b) {
+  a.node_positions_.sync<ModelSystem::HostMirrorSpace>();
+  b.node_positions_.sync<ModelSystem::HostMirrorSpace>();
+  double difference = 0;
+  for (int i=0; i<a.node_positions_.size(); i++)
+    difference = Kokkos::fmax(difference, CoreMath::mod(a.node_positions_[i] -
+        b.node_positions_[i]));
+  return difference;
+}
+
+/// @brief throughput of update of two tubes, configured as the k-th by
+///     configure(system, k), and the largest difference of positions between them
+template <typename Configure>
+void test_compare(const char* first, const char* second, int steps, Configure configure) {
+  ModelSystem systems[2];
+  double seconds[2];
+  for (int k=0; k<2; k++) {
+    test_tube(systems[k]);
+    configure(systems[k], k);
+    seconds[k] = test_seconds([&]() {
+      for (int i=0; i<steps; i++)
+        systems[k].update();
+    });
+  }
+  double nodes = systems[0].node_positions_.size();
+  std::printf("%i steps of %.0f nodes: \t%s=%.3e nodes/s \t%s=%.3e nodes/s\n", steps,
+      nodes, first, nodes*steps/seconds[0], second, nodes*steps/seconds[1]);
+  std::printf("max difference of positions: %.3e\n", test_difference(systems[0], systems[1]));
+}
+
+/**
+ * @test throughput of update, the default path against the fused step, and the
+ *     largest difference of positions between them
+ */
+void test_fused_step() {
+  Kokkos::initialize(); {
+  test_compare("default", "fused", 10000, [](ModelSystem& system, int k) {
+    system.fused_step_ = (k == 1);
+  });
+  } Kokkos::finalize();
+}
+
+/// @brief adjacents converted to scalar T, for kernels of T
+template <typename T>
+inline CoreMath::Array<CoreMath::BasicVector<T>> test_convert(
+    const CoreMath::Array<CoreMath::Vector>& others) {
+  CoreMath::Array<CoreMath::BasicVector<T>> result(others.size());
+  for (int i=0; i<others.size(); i++)
+    result[i] = CoreMath::BasicVector<T>(others[i]);
+  return result;
+}
+
+/// @brief energy minimized by update on host, evaluated by kernels of scalar T and
+///     summed in double. Curvature of nodes near rigid ends has no forces in
+///     update, so it is left out
+template <typename T>
+double test_total_energy(ModelSystem& system) {
+  double energy = 0;
+  for (int i=0; i<system.node_positions_.size(); i++) {
+    for (auto j : test_convert<T>(system.h_get_positions(i, system.node_adjacents_bonds1_[i])))
+      energy += system.bond1_energy(j) / 2;
+    for (auto j : test_convert<T>(system.h_get_positions(i, system.node_adjacents_bonds2_[i])))
+      energy += system.bond2_energy(j) / 2;
+    if (!(system.node_flags_[i] & Metadata::kNodeNearRigid))
+      energy += system.curvature_energy(test_convert<T>(
+          system.h_get_positions(i, system.node_adjacents_curvature_[i])));
+  }
+  return energy;
+}
+
+/// @brief forces of that energy by double kernels on host, zero on rigid nodes
+void test_forces(ModelSystem& system, std::vector<CoreMath::Vector>& forces) {
+  forces.assign(system.node_positions_.size(), CoreMath::Vector());
+  for (int i=0; i<forces.size(); i++) {
+    for (auto j : system.h_get_positions(i, system.node_adjacents_bonds1_[i]))
+      forces[i] += system.bond1_gradient(j);
+    for (auto j : system.h_get_positions(i, system.node_adjacents_bonds2_[i]))
+      forces[i] += system.bond2_gradient(j);
+    if (system.node_flags_[i] & Metadata::kNodeNearRigid)
+      continue;
+    // gradients of the curvature of i, with respect to its adjacents
+    auto& adjacents = system.node_adjacents_curvature_[i];
+    auto gradient = system.curvature_gradient(system.h_get_positions(i, adjacents));
+    for (int j=0; j<adjacents.size(); j++) {
+      forces[i] += gradient[j];
+      forces[adjacents[j]] += -gradient[j];
+    }
+  }
+  for (int i=0; i<forces.size(); i++)
+    if (system.node_flags_[i] & Metadata::kNodeRigid)
+      forces[i] = CoreMath::Vector();
+}
+
+/// @brief relax nodes other than rigid ones by FIRE with double kernels on host,
+///     rigid ends stay where they are
+/// @return steps used
+int test_relax(ModelSystem& system, double force_tol, int max_steps) {
+  std::vector<CoreMath::Vector> forces, velocities(system.node_positions_.size());
+  double dt = system.step_length_, alpha = 0.1;
+  int positive = 0, step = 0;
+  for (; step<max_steps; step++) {
+    test_forces(system, forces);
+    double power = 0, force2 = 0, velocity2 = 0, max_force = 0;
+    for (int i=0; i<forces.size(); i++) {
+      power += forces[i] * velocities[i];
+      force2 += forces[i] * forces[i];
+      velocity2 += velocities[i] * velocities[i];
+      max_force = Kokkos::fmax(max_force, CoreMath::mod(forces[i]));
+    }
+    if (max_force < force_tol)
+      break;
+    if (power > 0) {
+      double mix = alpha * Kokkos::sqrt(velocity2 / force2);
+      for (int i=0; i<forces.size(); i++)
+        velocities[i] = velocities[i] * (1 - alpha) + forces[i] * mix;
+      if (++positive > 5) {
+        dt = Kokkos::fmin(dt * 1.1, 10 * system.step_length_);
+        alpha *= 0.99;
+      }
+    } else {
+      velocities.assign(velocities.size(), CoreMath::Vector());
+      dt *= 0.5;
+      alpha = 0.1;
+      positive = 0;
+    }
+    for (int i=0; i<forces.size(); i++) {
+      velocities[i] += forces[i] * dt;
+      system.node_positions_[i] += velocities[i] * dt;
+    }
+  }
+  return step;
+}
+
+/**
+ * @test kernels of float against double, and energy drift of a relaxation with
+ *     kernels of Real (float in builds with -DMixedPrecision=ON). The relaxed
+ *     configuration is relaxed further by double kernels on host, and the energy
+ *     it still loses is the drift.
+ * @return 0 if the drift is within tolerance
+ */
+int test_mixed_precision() {
+  int failed = 0;
+  Kokkos::initialize(); {
+  double para = 10;
+  auto others = test_adjacents();
+  auto others_float = test_convert<float>(others);
+  double energy = CoreEnergy::curvature_energy(&para, others);
+  double energy_float = CoreEnergy::curvature_energy(&para, others_float);
+  auto gradient = CoreEnergy::curvature_gradient(&para, others);
+  auto gradient_float = CoreEnergy::curvature_gradient(&para, others_float);
+  double difference = 0, norm = 0;
+  for (int i=0; i<others.size(); i++) {
+    difference = Kokkos::fmax(difference, CoreMath::mod(gradient[i] - gradient_float[i]));
+    norm = Kokkos::fmax(norm, CoreMath::mod(gradient[i]));
+  }
+  std::printf("float kernels: \trelative error of energy=%.3e \tgradient=%.3e\n",
+      Kokkos::fabs(energy_float - energy) / Kokkos::fabs(energy), difference / norm);
+
+  const double tolerance = 1e-5;
+  ModelSystem system;
+  test_tube(system);
+  ModelSystem::MinimizeParameters minimize_parameters;
+  int steps = system.minimize(minimize_parameters);
+  system.node_positions_.sync<ModelSystem::HostMirrorSpace>();
+
+  double energy_real = test_total_energy<CoreMath::Real>(system);
+  double energy_double = test_total_energy<double>(system);
+  int steps_double = test_relax(system, 1e-9, 100000);
+  double reference = test_total_energy<double>(system);
+  double drift = (energy_double - reference) / reference;
+  failed = !(drift < tolerance);
+  std::printf("relaxed in %i steps with %zu bytes scalar: \tenergy=%.8f \t"
+      "by double kernels=%.8f\n", steps, sizeof(CoreMath::Real), energy_real, energy_double);
+  std::printf("energy drift against double kernels (%i more steps): %.3e (%s, "
+      "tolerance %.0e)\n", steps_double, drift, failed ? "failed" : "passed", tolerance);
+  } Kokkos::finalize();
+  return failed;
+}
+
+/**
+ * @test throughput of update with gradients of curvature node by node
+ *     (kCurvatureGather) against SIMD lanes of nodes (kCurvatureBatch), and the
+ *     largest difference of positions between them
+ */
+void test_curvature_batch() {
+  Kokkos::initialize(); {
+  std::printf("%zu lanes\n", CoreMath::RealSimd::size());
+  test_compare("scalar", "batch", 10000, [](ModelSystem& system, int k) {
+    system.curvature_scheme_ = (k == 0) ? ModelSystem::kCurvatureGather :
+        ModelSystem::kCurvatureBatch;
+  });
+  } Kokkos::finalize();
+}
+
+/// @brief largest error of energy and dE/d(r^2) of table against Potential, over
+///     samples in its range, and time of evaluations by both
+template <typename Potential>
+void test_pair_table_of(const char* name, const double* para) {
+  const int samples = 1000000;
+  CoreEnergy::PairTable table;
+  table.build<Potential>(para, 4096);
+  double r2_min, r2_max;
+  Potential::range(para, r2_min, r2_max);
+
+  // errors relative to the largest magnitude in range
+  double energy_error = 0, derivative_error = 0, energy_max = 0, derivative_max = 0;
+  double sum[2] = {0, 0};
+  for (int i=0; i<samples; i++) {
+    double r2 = r2_min + (r2_max - r2_min) * (i + 0.5) / samples;
+    energy_error = Kokkos::fmax(energy_error, Kokkos::fabs(table.energy(r2) -
+        Potential::energy(para, r2)));
+    derivative_error = Kokkos::fmax(derivative_error, Kokkos::fabs(table.derivative(r2) -
+        Potential::derivative(para, r2)));
+    energy_max = Kokkos::fmax(energy_max, Kokkos::fabs(Potential::energy(para, r2)));
+    derivative_max = Kokkos::fmax(derivative_max, Kokkos::fabs(Potential::derivative(para, r2)));
+  }
+  auto t1 = std::chrono::high_resolution_clock::now();
+  for (int i=0; i<samples; i++)
+    sum[0] += Potential::derivative(para, r2_min + (r2_max - r2_min) * (i + 0.5) / samples);
+  auto t2 = std::chrono::high_resolution_clock::now();
+  for (int i=0; i<samples; i++)
+    sum[1] += table.derivative(r2_min + (r2_max - r2_min) * (i + 0.5) / samples);
+  auto t3 = std::chrono::high_resolution_clock::now();
+
+  std::chrono::duration<double> duration1 = t2 - t1, duration2 = t3 - t2;
+  std::printf("%s: \trelative error of energy=%.3e \tderivative=%.3e\n", name,
+      energy_error / energy_max, derivative_error / derivative_max);
+  std::printf("total time: \tanalytic=%fms \ttable=%fms \t(sums %.6e %.6e)\n",
+      duration1.count()*1000, duration2.count()*1000, sum[0], sum[1]);
+}
+
+/**
+ * @test tables of pair potentials against the analytic forms, with default
+ *     parameters of EnergyMetaData
+ */
+void test_pair_table() {
+  Kokkos::initialize(); {
+  Metadata::EnergyMetaData para;
+  test_pair_table_of<Metadata::EnergyMetaData::Bond1Potential>("bond1",
+      para.energy_parameters().bond1.para);
+  test_pair_table_of<Metadata::EnergyMetaData::Bond2Potential>("bond2",
+      para.energy_parameters().bond2.para);
+  } Kokkos::finalize();
+}
+
+/**
+ * @test throughput of update instantiated for the triangular policy against the
+ *     quadrangular one on the same triangular tube, whose bonds 2 are empty, and the
+ *     largest difference of positions between them
+ */
+void test_energy_policy() {
+  Kokkos::initialize(); {
+  test_compare("triangular", "quadrangular", 10000, [](ModelSystem& system, int k) {
+    // bonds 2 are visited but empty
+    if (k == 1)
+      system.lattice_ = Metadata::kQuadrangular;
+  });
+  } Kokkos::finalize();
+}
+
+/**
+ * @test forces of bonds 2 by update of the quadrangular policy against numeric
+ *     derivatives of their energy, on a small quadrangular patch with diagonals in
+ *     every other square. Nothing else has energy, and the patch is perturbed so
+ *     that every diagonal is stretched or compressed
+ * @return 0 if the largest relative error is within tolerance
+ */
+int test_bond2_forces() {
+  int failed = 0;
+  Kokkos::initialize(); {
+  const int size = 6;
+  ModelSystem system;
+  system.lattice_ = Metadata::kQuadrangular;
+  system.bond1_spring_constant_ = 0;
+  system.bond2_spring_constant_ = 1;
+  system.curvature_bending_rigidity_ = 0;
+  int n = size * size;
+  auto flat = [&](int i, int j) { return i * size + j; };
+  CoreMath::Pool pool;
+  pool.set_state(7, 0);
+  system.node_positions_.init(0, n);
+  for (int i=0; i<size; i++)
+    for (int j=0; j<size; j++)
+      system.node_positions_.push_back(CoreMath::Vector(i, j, 0) +
+          pool.gen_vector(0.2, flat(i, j)));
+  system.node_velocities_.init(n);
+  system.node_flags_.init(n);
+  system.node_adjacents_bonds1_.init(n);
+  system.node_adjacents_bonds2_.init(n);
+  system.node_adjacents_curvature_.init(n);
+  system.bond_relations1_.init(0, 2 * n);
+  system.bond_relations2_.init(0, n);
+  auto bond = [&](CoreMath::HostView<CoreMath::Array<int>>& adjacents,
+      CoreMath::View<CoreMath::Pair<int>>& relations, int a, int b) {
+    adjacents[a].push_back(b);
+    adjacents[b].push_back(a);
+    relations.push_back(CoreMath::Pair<int>(a, b));
+  };
+  for (int i=0; i<size; i++)
+    for (int j=0; j<size; j++) {
+      if (i + 1 < size)
+        bond(system.node_adjacents_bonds1_, system.bond_relations1_, flat(i, j), flat(i+1, j));
+      if (j + 1 < size)
+        bond(system.node_adjacents_bonds1_, system.bond_relations1_, flat(i, j), flat(i, j+1));
+      if (i + 1 < size && j + 1 < size && (i + j) % 2 == 0) {
+        bond(system.node_adjacents_bonds2_, system.bond_relations2_, flat(i, j), flat(i+1, j+1));
+        bond(system.node_adjacents_bonds2_, system.bond_relations2_, flat(i+1, j), flat(i, j+1));
+      }
+    }
+  system.node_positions_.modify_host();
+  system.node_positions_.sync_device();
+  system.node_flags_.modify_host();
+  system.node_flags_.sync_device();
+  system.bond_relations1_.modify_host();
+  system.bond_relations1_.sync_device();
+  system.bond_relations2_.modify_host();
+  system.bond_relations2_.sync_device();
+  system.resize_workspace();
+
+  // velocities of the overdamped step without noise are the forces
+  system.update(true);
+  system.node_velocities_.sync<ModelSystem::HostMirrorSpace>();
+  const double h = 1e-6;
+  double error = 0, largest = 0;
+  for (int i=0; i<n; i++)
+    for (int d=0; d<3; d++) {
+      double origin = system.node_positions_[i][d];
+      system.node_positions_[i][d] = origin + h;
+      double energy1 = test_total_energy<double>(system);
+      system.node_positions_[i][d] = origin - h;
+      double energy2 = test_total_energy<double>(system);
+      system.node_positions_[i][d] = origin;
+      double force = -(energy1 - energy2) / (2 * h);
+      error = Kokkos::fmax(error, Kokkos::fabs(system.node_velocities_[i][d] - force));
+      largest = Kokkos::fmax(largest, Kokkos::fabs(force));
+    }
+  std::printf("%i nodes, %zu bonds 2: 	largest force=%.3e 	relative error=%.3e\n", n,
+      system.bond_relations2_.size(), largest, error / largest);
+  failed = !(error <= 1e-6 * largest);
+  } Kokkos::finalize();
+  return failed;
+}
+
+/**
+ * @test throughput of replicas with different rigidities updated one by one (fused
+ *     step) against an ensemble of them, and the largest difference of positions
+ */
+void test_ensemble() {
+  Kokkos::initialize(); {
+  const int replicas = 8, steps = 2000;
+  ModelSystem systems[replicas];
+  double seconds = test_seconds([&]() {
+    for (int k=0; k<replicas; k++) {
+      test_tube(systems[k], 0.05 * (k + 1));
+      systems[k].fused_step_ = true;
+      for (int i=0; i<steps; i++)
+        systems[k].update();
+    }
+  });
+
+  ModelEnsemble ensemble(replicas);
+  for (int k=0; k<replicas; k++)
+    test_tube(ensemble.replica(k), 0.05 * (k + 1));
+  ensemble.pack();
+  double seconds_ensemble = test_seconds([&]() {
+    for (int i=0; i<steps; i++)
+      ensemble.update();
+  });
+
+  double difference = 0, nodes = 0;
+  for (int k=0; k<replicas; k++) {
+    ensemble.unpack(k);
+    nodes += ensemble.replica(k).node_positions_.size();
+    difference = Kokkos::fmax(difference, test_difference(ensemble.replica(k), systems[k]));
+  }
+  std::printf("%i replicas of %.0f nodes, %i steps: \tone by one=%.3e nodes/s \t"
+      "ensemble=%.3e nodes/s\n", replicas, nodes / replicas, steps,
+      nodes*steps/seconds, nodes*steps/seconds_ensemble);
+  std::printf("max difference of positions: %.3e\n", difference);
+  } Kokkos::finalize();
+}
+
+void test_sweep() {
+  Kokkos::initialize(); {
+  // jobs of different sizes and steps, thermal ones included
+  std::vector<UtilsSweep::Job> jobs;
+  for (int k=0; k<8; k++) {
+    UtilsSweep::Job job;
+    job.name = "job" + std::to_string(k);
+    job.parameters.repeat = 4 + 2 * (k % 3);
+    job.bending_rigidity = 0.05 * (k + 1);
+    job.temperature = (k % 4 == 3) ? 1e-4 : 0;
+    job.steps = 2000 + 500 * k;
+    jobs.push_back(job);
+  }
+
+  auto t1 = std::chrono::high_resolution_clock::now();
+  auto serial = UtilsSweep::Runner(1).run(jobs);
+  auto t2 = std::chrono::high_resolution_clock::now();
+  auto concurrent = UtilsSweep::Runner(4).run(jobs);
+  auto t3 = std::chrono::high_resolution_clock::now();
+
+  double difference = 0;
+  for (int k=0; k<jobs.size(); k++) {
+    if (jobs[k].temperature != 0)
+      continue;  // noise depends on pool state, not comparable
+    difference = Kokkos::fmax(difference, Kokkos::fabs(serial[k].curvature_energy -
+        concurrent[k].curvature_energy) + Kokkos::fabs(serial[k].bond1_energy -
+        concurrent[k].bond1_energy));
+  }
+  std::chrono::duration<double> duration1 = t2 - t1, duration2 = t3 - t2;
+  std::printf("%zu jobs: \t1 partition=%.3f s \t4 partitions=%.3f s \tspeedup=%.2f\n",
+      jobs.size(), duration1.count(), duration2.count(), duration1 / duration2);
+  std::printf("max difference of energies: %.3e\n", difference);
+  } Kokkos::finalize();
+}
+
+/**
+ * @test N steps, store, load into a fresh system and M steps more, against N+M steps
+ *     without interruption, at nonzero temperature so that the random state is
+ *     covered, with fixed and adaptive step
+ * @return number of cases whose positions aren't the same bit for bit
+ */
+int test_checkpoint() {
+  int failed = 0;
+  Kokkos::initialize(); {
+  const int steps1 = 300, steps2 = 300;
+  const char file_name[] = "test_checkpoint.bin";
+  for (int adaptive=0; adaptive<2; adaptive++) {
+    // adaptive steps are rolled back often, also right after load
+    auto configure = [&](ModelSystem& system) {
+      system.temperature_ = 1e-2;
+      system.adaptive_step_.enable = adaptive;
+      system.adaptive_step_.max_change = 1e-6;
+    };
+    ModelSystem whole, restarted;
+    test_tube(whole);
+    configure(whole);
+    for (int i=0; i<steps1; i++)
+      whole.update();
+    whole.store(file_name);
+    for (int i=0; i<steps2; i++)
+      whole.update();
+
+    configure(restarted);
+    restarted.load(file_name);
+    for (int i=0; i<steps2; i++)
+      restarted.update();
+    double difference = test_difference(whole, restarted);
+    std::printf("%s step, %i + %i steps: max difference of positions %.3e, "
+        "rejected %i/%i\n", adaptive ? "adaptive" : "fixed", steps1, steps2, difference,
+        whole.thermo().rejected, restarted.thermo().rejected);
+    failed += difference != 0 || whole.thermo().rejected != restarted.thermo().rejected;
+  }
+  std::remove(file_name);
+  } Kokkos::finalize();
+  return failed;
+}
+
+#ifdef QUADRATUBE_MPI
+/// @brief run by `mpirun -np k`, a long tube in k slabs against the whole one on rank 0
+void test_decomposition() {
+  MPI_Init(nullptr, nullptr);
+  Kokkos::initialize(); {
+  int rank, size;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  MPI_Comm_size(MPI_COMM_WORLD, &size);
+  const int steps = 1000;
+  auto configure = [](ModelSystem& system) {
+    test_tube(system, 0.1, 64);
+    system.temperature_ = 1e-4;
+  };
+
+  // only rank 0 builds the tube, its reference draws the noises of the seed slabs
+  // take from rank 0
+  ModelSystem global, whole;
+  double duration1 = 0;
+  if (rank == 0) {
+    configure(global);
+    configure(whole);
+    whole.rand_pool_.set_state(global.rand_pool_.seed(), global.rand_pool_.counter());
+    duration1 = test_seconds([&]() {
+      for (int i=0; i<steps; i++)
+        whole.update();
+    });
+  }
+
+  ModelDecomposition decomposition(global, MPI_COMM_WORLD);
+  auto& slab = decomposition.system();
+  double nodes = decomposition.owned_nodes();
+  double ghosts = slab.node_positions_.size() - decomposition.owned_nodes();
+  decomposition.allreduce(&nodes, 1, false);
+  decomposition.allreduce(&ghosts, 1, false);
+  double duration2 = test_seconds([&]() {
+    MPI_Barrier(MPI_COMM_WORLD);
+    for (int i=0; i<steps; i++)
+      slab.update();
+    Kokkos::fence();
+    MPI_Barrier(MPI_COMM_WORLD);
+  });
+
+  decomposition.gather();
+  if (rank == 0) {
+    std::printf("%i ranks, %.0f nodes (%.0f ghosts), %i steps: \twhole=%.3e nodes/s "
+        "\tslabs=%.3e nodes/s\n", size, nodes, ghosts, steps, nodes*steps/duration1,
+        nodes*steps/duration2);
+    std::printf("max difference of positions: %.3e\n", test_difference(global, whole));
+  }
+  } Kokkos::finalize();
+  MPI_Finalize();
+}
+#endif // QUADRATUBE_MPI
@@ -10,29 +10,65 @@
 #include "utils/modifier.h"
 
 namespace UtilsModifier {
-  double Modifier::total_energy(CoreMath::Vector range_l, CoreMath::Vector range_r) {
-    double count = 0;
-    for (int i=0; i<__system.node_positions_.size(); i++) {
-      auto others1 = __system.h_get_positions(i, __system.node_adjacents_bonds1_[i]);
-      auto others2 = __system.h_get_positions(i, __system.node_adjacents_bonds2_[i]);
-      auto others3 = __system.h_get_positions(i, __system.node_adjacents_curvature_[i]);
-      for (int i=0; i<others1.size(); i++)
-        count += __system.bond1_energy(others1[i]) / 2;
-      for (int i=0; i<others2.size(); i++)
-        count += __system.bond2_energy(others2[i]) / 2;
-      count += __system.curvature_energy(others3);
-    }
-    return count;
-  }
+  Result Modifier::compute(CoreMath::Vector range_l, CoreMath::Vector range_r) {
+    __system.update_pair_tables();
+    __system.node_positions_.sync<ModelSystem::MemorySpace>();
+    // only what the kernel reads, views are shared with system. Parameters and pair
+    // tables are sliced off the system
+    Metadata::EnergyMetaData energy = __system;
+    auto positions = __system.node_positions_;
+    auto flags = __system.node_flags_;
+    auto csr_bonds1 = __system.csr_bonds1_;
+    auto csr_bonds2 = __system.csr_bonds2_;
+    auto csr_curvature = __system.csr_curvature_;
+
+    Result result;
+    Kokkos::parallel_reduce(Kokkos::RangePolicy<ModelSystem::ExecutionSpace>(
+        __system.execution_space_, 0, positions.size()), KOKKOS_LAMBDA(const int i,
+        Result& inner) {
+      // ghosts of a slab are counted by their owners
+      if (flags(i) & Metadata::kNodeGhost)
+        return;
+      CoreMath::Vector p = positions(i);
+      if (p[0] <= range_l[0] || p[0] >= range_r[0] || p[1] <= range_l[1] ||
+          p[1] >= range_r[1] || p[2] <= range_l[2] || p[2] >= range_r[2])
+        return;
+
+      // relative positions of adjacents, the same as ModelSystem::d_get_positions
+      CoreMath::Array<CoreMath::RealVector> others[3];
+      const CoreMath::Csr::Row rows[3] = {csr_bonds1(i), csr_bonds2(i), csr_curvature(i)};
+      for (int k=0; k<3; k++) {
+        others[k].resize(rows[k].size());
+        for (int j=0; j<rows[k].size(); j++)
+          others[k][j] = CoreMath::RealVector(positions(rows[k][j]) - p);
+      }
+      inner.particles++;
+      // bonds are shared by two nodes
+      for (int j=0; j<others[0].size(); j++)
+        inner.bond1_energy += energy.bond1_energy(others[0][j]) / 2;
+      for (int j=0; j<others[1].size(); j++)
+        inner.bond2_energy += energy.bond2_energy(others[1][j]) / 2;
+      inner.curvature_energy += energy.curvature_energy(others[2]);
+
+      double extras[Extras::size];
+      Extras::evaluate(~Metadata::DumpType(0), energy, others[0], others[1], others[2],
+          extras);
+      for (int j=0; j<Extras::size; j++)
+        inner.extras[j] += extras[j];
+    }, result);
 
-  int Modifier::total_particle(CoreMath::Vector range_l, CoreMath::Vector range_r) {
-    int count = 0;
-    for (int i=0; i<__system.node_positions_.size(); i++) {
-      if (__system.node_positions_[i][0] > range_l[0] && __system.node_positions_[i][0] < range_r[0] &&
-        __system.node_positions_[i][1] > range_l[1] && __system.node_positions_[i][1] < range_r[1] &&
-        __system.node_positions_[i][2] > range_l[2] && __system.node_positions_[i][2] < range_r[2])
-        count++;
-    }
-    return count;
+    // sums over every slab of a decomposed system
+    double sums[4 + Extras::size] = {static_cast<double>(result.particles),
+        result.bond1_energy, result.bond2_energy, result.curvature_energy};
+    for (int j=0; j<Extras::size; j++)
+      sums[4 + j] = result.extras[j];
+    __system.allreduce(sums, 4 + Extras::size);
+    result.particles = sums[0];
+    result.bond1_energy = sums[1];
+    result.bond2_energy = sums[2];
+    result.curvature_energy = sums[3];
+    for (int j=0; j<Extras::size; j++)
+      result.extras[j] = sums[4 + j];
+    return result;
   }
-} // namespace UtilsModifier
\ No newline at end of file
+} // namespace UtilsModifier
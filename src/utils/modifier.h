@@ -10,23 +10,69 @@
 #ifndef QUADRATUBE_UTILS_MODIFIER_H_
 #define QUADRATUBE_UTILS_MODIFIER_H_
 
+#include <Kokkos_Core.hpp>
+
+#include "metadata.h"
 #include "core/math.h"
 #include "model/system.h"
 
 namespace UtilsModifier {
 
+/// @brief extra observables summed in box, append column functors to register
+using Extras = Metadata::DumpColumnList<Metadata::GaussianCurvatureColumn,
+    Metadata::MeanCurvatureColumn>;
+
 /**
- * @brief modifier of system
+ * @brief global quantities of nodes in a box
  * 
  */
+struct Result {
+  int particles;
+  double bond1_energy;
+  double bond2_energy;
+  double curvature_energy;
+  /// @brief sum of each observable in Extras
+  double extras[Extras::size];
+
+  KOKKOS_INLINE_FUNCTION
+  Result(): particles(0), bond1_energy(0), bond2_energy(0), curvature_energy(0), extras{0} {}
+
+  KOKKOS_INLINE_FUNCTION
+  Result& operator+=(const Result& p) {
+    particles += p.particles;
+    bond1_energy += p.bond1_energy;
+    bond2_energy += p.bond2_energy;
+    curvature_energy += p.curvature_energy;
+    for (int i=0; i<Extras::size; i++)
+      extras[i] += p.extras[i];
+    return *this;
+  }
+
+  inline double total_energy() const {
+    return bond1_energy + bond2_energy + curvature_energy;
+  }
+};
+
+/**
+ * @brief modifier of system
+ * @details Every quantity is computed by one parallel_reduce on device, positions
+ *     don't need to be synced to host. Construct once and reuse.
+ */
 class Modifier {
   public:
     inline Modifier(ModelSystem& system): __system(system) {}
 
+    /// @brief every quantity in this box (open interval), in one sweep
+    Result compute(CoreMath::Vector range_l, CoreMath::Vector range_r);
+
     /// @brief total energy in this box
-    double total_energy(CoreMath::Vector range_l, CoreMath::Vector range_r);
+    inline double total_energy(CoreMath::Vector range_l, CoreMath::Vector range_r) {
+      return compute(range_l, range_r).total_energy();
+    }
     /// @brief total particle numbers in this box
-    int total_particle(CoreMath::Vector range_l, CoreMath::Vector range_r);
+    inline int total_particle(CoreMath::Vector range_l, CoreMath::Vector range_r) {
+      return compute(range_l, range_r).particles;
+    }
 
   private:
     ModelSystem& __system;
@@ -34,4 +80,17 @@ class Modifier {
 
 } // namespace UtilsModifier
 
-#endif // QUADRATUBE_UTILS_MODIFIER_H_
\ No newline at end of file
+// reduction identity of Result, must be defined in Kokkos namespace
+namespace Kokkos {
+
+template<>
+struct reduction_identity<UtilsModifier::Result> {
+  KOKKOS_FORCEINLINE_FUNCTION
+  static UtilsModifier::Result sum() {
+    return UtilsModifier::Result();
+  }
+};
+
+} // namespace Kokkos
+
+#endif // QUADRATUBE_UTILS_MODIFIER_H_
@@ -0,0 +1,204 @@
+/**
+ * @file sweep.cpp
+ * @author Bohan Cao (2110313@mail.nankai.edu.cn)
+ * @brief Concurrent parameter sweep
+ * @version 0.0.1
+ * @date 2023-03-26
+ *
+ * @copyright Copyright (c) 2023
+ */
+#include "utils/sweep.h"
+
+#include <stdio.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <memory>
+#include <numeric>
+#include <sstream>
+#include <thread>
+
+#include "utils/modifier.h"
+
+namespace UtilsSweep {
+
+std::vector<Job> read_jobs(const std::string& file_name) {
+  std::ifstream file(file_name);
+  if (!file)
+    Kokkos::abort(("read_jobs: can't read " + file_name).c_str());
+
+  std::vector<Job> jobs;
+  std::string line;
+  for (int line_number=1; std::getline(file, line); line_number++) {
+    line = line.substr(0, line.find('#'));
+    std::istringstream tokens(line);
+    std::string token;
+    Job job;
+    bool empty = true;
+    while (tokens >> token) {
+      empty = false;
+      auto equal = token.find('=');
+      std::string key = token.substr(0, equal);
+      std::string value = (equal == std::string::npos) ? "" : token.substr(equal + 1);
+      const char* v = value.c_str();
+      auto& p = job.parameters;
+      if (key == "name") job.name = value;
+      else if (key == "m") p.m = std::atoi(v);
+      else if (key == "n") p.n = std::atoi(v);
+      else if (key == "repeat") p.repeat = std::atoi(v);
+      else if (key == "direction") p.direction = std::atoi(v);
+      else if (key == "glide") p.glide = std::atoi(v);
+      else if (key == "climb") p.climb = std::atoi(v);
+      else if (key == "bn") p.bn = std::atoi(v);
+      else if (key == "rest_len") p.rest_len = std::atof(v);
+      else if (key == "reorder") p.reorder = std::atoi(v) != 0;
+      else if (key == "rigidity") job.bending_rigidity = std::atof(v);
+      else if (key == "spring") job.spring_constant = std::atof(v);
+      else if (key == "temperature") job.temperature = std::atof(v);
+      else if (key == "damp") job.damp_coeff = std::atof(v);
+      else if (key == "steps") job.steps = std::atoi(v);
+      else if (key == "force_tol") job.force_tol = std::atof(v);
+      else if (key == "dump") job.dump = value;
+      else
+        Kokkos::abort(("read_jobs: unknown key " + key + " in line " +
+            std::to_string(line_number) + " of " + file_name).c_str());
+    }
+    if (empty)
+      continue;
+    if (job.name.empty())
+      job.name = "line" + std::to_string(line_number);
+    jobs.push_back(job);
+  }
+  return jobs;
+}
+
+void write_summaries(const std::string& file_name, const std::vector<Summary>& summaries) {
+  FILE *file = std::fopen(file_name.c_str(), "w");
+  if (file == NULL) {
+    std::fprintf(stderr, "write_summaries: can't open %s\n", file_name.c_str());
+    return;
+  }
+  std::fprintf(file, "# name\tpartition\tnodes\tsteps\trelaxed\tseconds\tepot\tbond1\t"
+      "bond2\tcurvature\n");
+  for (auto& i : summaries)
+    std::fprintf(file, "%s\t%i\t%i\t%i\t%i\t%.3f\t%.8f\t%.8f\t%.8f\t%.8f\n", i.name.c_str(),
+        i.partition, i.nodes, i.steps, static_cast<int>(i.relaxed), i.seconds,
+        i.bond1_energy + i.bond2_energy + i.curvature_energy, i.bond1_energy,
+        i.bond2_energy, i.curvature_energy);
+  std::fclose(file);
+}
+
+void WorkQueue::push(int worker, int job) {
+  std::lock_guard<std::mutex> lock(__deques[worker].mutex);
+  __deques[worker].jobs.push_back(job);
+}
+
+bool WorkQueue::pop(int worker, int& job) {
+  // own deque from the front, then others from the back, nearest first
+  int workers = __deques.size();
+  for (int k=0; k<workers; k++) {
+    auto& deque = __deques[(worker + k) % workers];
+    std::lock_guard<std::mutex> lock(deque.mutex);
+    if (deque.jobs.empty())
+      continue;
+    if (k == 0) {
+      job = deque.jobs.front();
+      deque.jobs.pop_front();
+    } else {
+      job = deque.jobs.back();
+      deque.jobs.pop_back();
+    }
+    return true;
+  }
+  return false;
+}
+
+std::vector<Summary> Runner::run(const std::vector<Job>& jobs) {
+  std::vector<Summary> summaries(jobs.size());
+  if (jobs.empty())
+    return summaries;
+  int partitions = __partitions;
+  if (partitions <= 0)
+    partitions = std::max(1, ModelSystem::ExecutionSpace().concurrency() / 4);
+  partitions = std::min(partitions, static_cast<int>(jobs.size()));
+  auto spaces = Kokkos::Experimental::partition_space(ModelSystem::ExecutionSpace(),
+      std::vector<int>(partitions, 1));
+
+  // longest first, dealt round robin, so stealing takes short jobs
+  std::vector<int> order(jobs.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(), [&](int i, int j) {
+    return jobs[i].cost() > jobs[j].cost();
+  });
+  WorkQueue queue(partitions);
+  for (int k=0; k<order.size(); k++)
+    queue.push(k % partitions, order[k]);
+
+  std::vector<std::thread> workers;
+  for (int w=0; w<partitions; w++)
+    workers.emplace_back([&, w]() {
+      int job;
+      while (queue.pop(w, job)) {
+        summaries[job] = __run(jobs[job], spaces[w]);
+        summaries[job].partition = w;
+      }
+    });
+  for (auto& i : workers)
+    i.join();
+  return summaries;
+}
+
+Summary Runner::__run(const Job& job, const ModelSystem::ExecutionSpace& space) {
+  auto t1 = std::chrono::steady_clock::now();
+  Summary summary;
+  summary.name = job.name;
+
+  // views are allocated, synced between host and device and freed on the default
+  // instance, so build, modifier, dump and destruction are done one job at a time.
+  // Update and minimize allocate nothing once init has sized the workspace.
+  auto owner = std::make_unique<ModelSystem>();
+  auto& system = *owner;
+  system.execution_space_ = space;
+  system.curvature_bending_rigidity_ = job.bending_rigidity;
+  system.bond2_spring_constant_ = job.spring_constant;
+  system.temperature_ = job.temperature;
+  system.damp_coeff_ = job.damp_coeff;
+  {
+    std::lock_guard<std::mutex> lock(__allocation_mutex);
+    ModelInitializer::Initializer initializer(system);
+    initializer.init(job.parameters);
+  }
+
+  if (job.temperature == 0) {
+    ModelSystem::MinimizeParameters parameters;
+    parameters.force_tol = job.force_tol;
+    parameters.max_steps = job.steps;
+    summary.steps = system.minimize(parameters);
+    summary.relaxed = summary.steps < job.steps;
+  } else {
+    for (int i=0; i<job.steps; i++)
+      system.update();
+    summary.steps = job.steps;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(__allocation_mutex);
+    UtilsModifier::Modifier modifier(system);
+    auto result = modifier.compute(CoreMath::Vector(-INFINITY, -INFINITY, -INFINITY),
+        CoreMath::Vector(INFINITY, INFINITY, INFINITY));
+    summary.nodes = result.particles;
+    summary.bond1_energy = result.bond1_energy;
+    summary.bond2_energy = result.bond2_energy;
+    summary.curvature_energy = result.curvature_energy;
+    if (!job.dump.empty())
+      system.dump(job.dump, Metadata::kPrintAll);
+    owner.reset();
+  }
+  summary.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t1).count();
+  return summary;
+}
+
+} // namespace UtilsSweep
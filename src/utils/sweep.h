@@ -0,0 +1,123 @@
+/**
+ * @file sweep.h
+ * @author Bohan Cao (2110313@mail.nankai.edu.cn)
+ * @brief Concurrent parameter sweep
+ * @version 0.0.1
+ * @date 2023-03-26
+ *
+ * @copyright Copyright (c) 2023
+ */
+#ifndef QUADRATUBE_UTILS_SWEEP_H_
+#define QUADRATUBE_UTILS_SWEEP_H_
+
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <Kokkos_Core.hpp>
+
+#include "metadata.h"
+#include "model/initializer.h"
+#include "model/system.h"
+
+namespace UtilsSweep {
+
+/// @brief a run of the sweep, from a line of the job list
+struct Job {
+  std::string name;
+  ModelInitializer::Parameters parameters = {
+    .m = 13, .n = 11, .repeat = 8, .direction = -1, .glide = 5, .climb = 0, .bn = 0,
+    .rest_len = 1, .reorder = true, .lattice = Metadata::kTriangular
+  };
+  double bending_rigidity = 0.1;
+  double spring_constant = 1;  ///< of bonds 2
+  double temperature = 0;
+  double damp_coeff = 1;
+  /// @brief steps of update, or the most steps of minimize at zero temperature
+  int steps = 100000;
+  double force_tol = 1e-6;
+  /// @brief file name to dump the final state into, none if empty
+  std::string dump;
+
+  /// @brief estimated cost, nodes times steps
+  inline double cost() const {
+    return static_cast<double>(parameters.m) * parameters.n * parameters.repeat * steps;
+  }
+};
+
+/**
+ * @brief read a job list
+ * @details A job per line as key=value pairs separated by spaces, and '#' starts a
+ *     comment. Keys are name, m, n, repeat, direction, glide, climb, bn, rest_len,
+ *     reorder, rigidity, spring, temperature, damp, steps, force_tol and dump, missing
+ *     ones keep the defaults of Job. Unnamed jobs are named by line.
+ */
+std::vector<Job> read_jobs(const std::string& file_name);
+
+/// @brief result of a job
+struct Summary {
+  std::string name;
+  int partition = -1;  ///< partition the job ran on
+  int nodes = 0;
+  int steps = 0;
+  bool relaxed = false;  ///< minimize reached force_tol, zero temperature only
+  double seconds = 0;    ///< wall time of build, run and dump
+  double bond1_energy = 0, bond2_energy = 0, curvature_energy = 0;
+};
+
+/// @brief a tab separated line per job, in order of the job list
+void write_summaries(const std::string& file_name, const std::vector<Summary>& summaries);
+
+/**
+ * @class WorkQueue
+ * @brief Work-stealing queue of job indices
+ * @details Every worker owns a deque and takes jobs from its front. An idle worker
+ *     steals from the back of another one, where the shortest jobs of a deque dealt
+ *     longest first are. Jobs are pushed before workers start.
+ */
+class WorkQueue {
+  public:
+    inline explicit WorkQueue(int workers): __deques(workers) {}
+    void push(int worker, int job);
+    /// @brief next job of worker, false if every deque is empty
+    bool pop(int worker, int& job);
+
+  private:
+    struct Deque {
+      std::mutex mutex;
+      std::deque<int> jobs;
+    };
+    std::vector<Deque> __deques;
+};
+
+/**
+ * @class Runner
+ * @brief Runs jobs concurrently in one process
+ * @details The default execution space is split into partitions of equal weight by
+ *     Kokkos::Experimental::partition_space (threads of OpenMP, streams of CUDA). A
+ *     thread per partition runs jobs from a WorkQueue, each with a ModelSystem whose
+ *     execution_space_ is the partition. Views are allocated, synced and freed on the
+ *     default instance, so everything of a job but update or minimize (build,
+ *     modifier, dump, destruction) is done one job at a time. The workspace is sized
+ *     by init, so update and minimize of a job allocate nothing.
+ */
+class Runner {
+  public:
+    /// @brief number of partitions, 0 for a partition per 4 threads of concurrency
+    inline explicit Runner(int partitions = 0): __partitions(partitions) {}
+
+    /// @brief summaries in order of jobs
+    std::vector<Summary> run(const std::vector<Job>& jobs);
+
+  private:
+    Summary __run(const Job& job, const ModelSystem::ExecutionSpace& space);
+
+    int __partitions;
+    /// @brief held by every allocating part of a job
+    std::mutex __allocation_mutex;
+};
+
+} // namespace UtilsSweep
+
+#endif // QUADRATUBE_UTILS_SWEEP_H_
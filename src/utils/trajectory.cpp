@@ -0,0 +1,294 @@
+/**
+ * @file trajectory.cpp
+ * @author Bohan Cao (2110313@mail.nankai.edu.cn)
+ * @brief Binary trajectory with frame index
+ * @version 0.0.1
+ * @date 2023-03-22
+ * 
+ * @copyright Copyright (c) 2023
+ */
+#include "utils/trajectory.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstring>
+
+namespace UtilsTrajectory {
+
+namespace {
+
+inline bool host_is_little() {
+  const uint16_t one = 1;
+  return *reinterpret_cast<const char*>(&one) == 1;
+}
+
+/// @brief reverse bytes of every element with size of n
+void swap_bytes(char* data, size_t size, size_t n) {
+  for (size_t i=0; i<n; i++)
+    for (size_t j=0; j<size/2; j++) {
+      char t = data[i*size + j];
+      data[i*size + j] = data[i*size + size-1-j];
+      data[i*size + size-1-j] = t;
+    }
+}
+
+/// @brief write n numbers of type T in little-endian
+template <typename T>
+bool write_little(FILE* file, const T* data, size_t n) {
+  if (host_is_little())
+    return std::fwrite(data, sizeof(T), n, file) == n;
+  std::vector<T> buffer(data, data + n);
+  swap_bytes(reinterpret_cast<char*>(buffer.data()), sizeof(T), n);
+  return std::fwrite(buffer.data(), sizeof(T), n, file) == n;
+}
+
+/// @brief header and trailer are written field by field for endianness
+bool write_header(FILE* file, const Header& header) {
+  return std::fwrite(header.magic, 1, 8, file) == 8 &&
+      write_little(file, &header.version, 1) && write_little(file, &header.flags, 1) &&
+      write_little(file, &header.atoms, 1) && write_little(file, &header.bonds1, 1) &&
+      write_little(file, &header.bonds2, 1) && write_little(file, &header.columns, 1) &&
+      write_little(file, &header.reserved, 1) && write_little(file, header.boundary, 6) && write_little(file, &header.mass, 1) &&
+      std::fwrite(header.column_names, 1, sizeof(header.column_names), file) ==
+          sizeof(header.column_names);
+}
+bool write_trailer(FILE* file, const Trailer& trailer) {
+  return write_little(file, &trailer.index_offset, 1) && write_little(file, &trailer.frames, 1) &&
+      std::fwrite(trailer.magic, 1, 8, file) == 8;
+}
+template <typename T>
+T read_little(T in) {
+  if (!host_is_little())
+    swap_bytes(reinterpret_cast<char*>(&in), sizeof(T), 1);
+  return in;
+}
+
+/// @brief frames begin after topology, aligned to 8 bytes for mapping
+uint64_t first_frame(uint64_t atoms, uint64_t bonds1, uint64_t bonds2) {
+  return (sizeof(Header) + 4*atoms + 8*(bonds1 + bonds2) + 7) / 8 * 8;
+}
+uint64_t frame_width(uint64_t atoms, uint32_t flags, uint32_t columns) {
+  int vectors = ((flags & kHasVelocities) != 0) ? 2 : 1;
+  return sizeof(int64_t) + (3*vectors + columns)*atoms*sizeof(double) + sizeof(kFrameMagic);
+}
+
+/// @brief offsets of complete frames from first, a frame is complete if its magic
+///     at the end is in place. read(offset, buffer) reads 8 bytes
+template <typename F>
+std::vector<uint64_t> scan_frames(uint64_t first, uint64_t width, uint64_t length, F read) {
+  std::vector<uint64_t> index;
+  char magic[8];
+  for (uint64_t offset = first; offset + width <= length; offset += width) {
+    if (!read(offset + width - sizeof(magic), magic) ||
+        std::memcmp(magic, kFrameMagic, sizeof(magic)) != 0)
+      break;
+    index.push_back(offset);
+  }
+  return index;
+}
+
+/// @brief pairs and vectors as plain numbers
+bool write_pairs(FILE* file, const std::vector<CoreMath::Pair<int>>& pairs) {
+  std::vector<int32_t> flat(2*pairs.size());
+  for (size_t i=0; i<pairs.size(); i++) {
+    flat[2*i] = pairs[i][0];
+    flat[2*i+1] = pairs[i][1];
+  }
+  return write_little(file, flat.data(), flat.size());
+}
+bool write_vectors(FILE* file, const CoreMath::Vector* vectors, size_t n) {
+  std::vector<double> flat(3*n);
+  for (size_t i=0; i<n; i++)
+    for (int j=0; j<3; j++)
+      flat[3*i+j] = vectors[i][j];
+  return write_little(file, flat.data(), flat.size());
+}
+
+} // namespace
+
+bool append(const std::string& file_name, const Topology& topology, int64_t time_step,
+    size_t atoms, const CoreMath::Vector* positions, const CoreMath::Vector* velocities,
+    const double* columns) {
+  Header header = {};
+  std::memcpy(header.magic, kHeaderMagic, sizeof(header.magic));
+  header.version = kVersion;
+  header.flags = (velocities != nullptr) ? kHasVelocities : 0;
+  header.atoms = atoms;
+  header.bonds1 = topology.bonds1.size();
+  header.bonds2 = topology.bonds2.size();
+  header.columns = topology.column_names.size();
+  std::memcpy(header.boundary, topology.boundary, sizeof(header.boundary));
+  header.mass = topology.mass;
+  for (int i=0; i<header.columns && i<kMaxColumns; i++)
+    std::strncpy(header.column_names[i], topology.column_names[i].c_str(), 15);
+  if (header.columns > kMaxColumns) {
+    std::fprintf(stderr, "trajectory: at most %i columns\n", kMaxColumns);
+    return false;
+  }
+
+  // index of existing frames
+  std::vector<uint64_t> index;
+  uint64_t width = frame_width(atoms, header.flags, header.columns);
+  FILE *file = (time_step != 0) ? std::fopen(file_name.c_str(), "r+b") : NULL;
+  if (file != NULL) {
+    Header old;
+    bool same = std::fread(&old, sizeof(old), 1, file) == 1 &&
+        std::memcmp(old.magic, kHeaderMagic, 8) == 0 &&
+        read_little(old.version) == kVersion && read_little(old.flags) == header.flags &&
+        read_little(old.atoms) == atoms && read_little(old.columns) == header.columns &&
+        std::fseek(file, 0, SEEK_END) == 0;
+    if (!same) {
+      std::fprintf(stderr, "trajectory: %s has different layout\n", file_name.c_str());
+      std::fclose(file);
+      return false;
+    }
+    uint64_t length = std::ftell(file);
+    uint64_t first = first_frame(atoms, read_little(old.bonds1), read_little(old.bonds2));
+
+    // frames are back to back, the index of an intact file lists all of them
+    Trailer trailer;
+    bool intact = length >= first + sizeof(trailer) &&
+        std::fseek(file, length - sizeof(trailer), SEEK_SET) == 0 &&
+        std::fread(&trailer, sizeof(trailer), 1, file) == 1 &&
+        std::memcmp(trailer.magic, kTrailerMagic, 8) == 0;
+    if (intact) {
+      trailer.frames = read_little(trailer.frames);
+      trailer.index_offset = read_little(trailer.index_offset);
+      intact = trailer.index_offset == first + trailer.frames*width &&
+          trailer.index_offset + trailer.frames*sizeof(uint64_t) + sizeof(trailer) == length;
+    }
+    if (intact) {
+      for (uint64_t k=0; k<trailer.frames; k++)
+        index.push_back(first + k*width);
+    } else {
+      // an append was interrupted, keep complete frames and write over the rest
+      index = scan_frames(first, width, length, [file](uint64_t offset, char* magic) {
+        return std::fseek(file, offset, SEEK_SET) == 0 && std::fread(magic, 1, 8, file) == 8;
+      });
+      std::fprintf(stderr, "trajectory: index of %s is broken, %zu frames recovered\n",
+          file_name.c_str(), index.size());
+    }
+    // new frame overwrites old index
+    std::fseek(file, first + index.size()*width, SEEK_SET);
+  } else {
+    // create with topology
+    file = std::fopen(file_name.c_str(), "wb");
+    if (file == NULL || !write_header(file, header) ||
+        !write_little(file, topology.types.data(), topology.types.size()) ||
+        !write_pairs(file, topology.bonds1) || !write_pairs(file, topology.bonds2)) {
+      std::fprintf(stderr, "trajectory: can't create %s\n", file_name.c_str());
+      if (file != NULL)
+        std::fclose(file);
+      return false;
+    }
+    // frames are aligned to 8 bytes for mapping
+    const char zeros[8] = {0};
+    std::fwrite(zeros, 1, (8 - std::ftell(file)%8) % 8, file);
+  }
+
+  // frame
+  index.push_back(std::ftell(file));
+  bool success = write_little(file, &time_step, 1) && write_vectors(file, positions, atoms) &&
+      (velocities == nullptr || write_vectors(file, velocities, atoms)) &&
+      write_little(file, columns, header.columns*atoms) &&
+      std::fwrite(kFrameMagic, 1, sizeof(kFrameMagic), file) == sizeof(kFrameMagic);
+
+  // index and trailer
+  Trailer trailer = {static_cast<uint64_t>(std::ftell(file)), index.size(), {}};
+  std::memcpy(trailer.magic, kTrailerMagic, sizeof(trailer.magic));
+  success = success && write_little(file, index.data(), index.size()) &&
+      write_trailer(file, trailer);
+  // a recovered file may have leftovers beyond the new trailer
+  success = success && std::fflush(file) == 0 &&
+      ftruncate(fileno(file), std::ftell(file)) == 0;
+  success = (std::fclose(file) == 0) && success;
+  if (!success)
+    std::fprintf(stderr, "trajectory: failed to write %s\n", file_name.c_str());
+  return success;
+}
+
+Reader::Reader(const std::string& file_name) {
+  int fd = open(file_name.c_str(), O_RDONLY);
+  struct stat file_stat;
+  if (fd < 0)
+    return;
+  if (fstat(fd, &file_stat) != 0 || !host_is_little() ||
+      static_cast<size_t>(file_stat.st_size) < sizeof(Header)) {
+    close(fd);
+    return;
+  }
+  void* map = mmap(NULL, file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED)
+    return;
+  __base = static_cast<const char*>(map);
+  __length = file_stat.st_size;
+
+  auto header = reinterpret_cast<const Header*>(__base);
+  if (std::memcmp(header->magic, kHeaderMagic, 8) != 0 || header->version != kVersion ||
+      header->columns > kMaxColumns)
+    return;
+  uint64_t first = first_frame(header->atoms, header->bonds1, header->bonds2);
+  uint64_t width = frame_width(header->atoms, header->flags, header->columns);
+  if (first > __length)
+    return;
+  __header = header;
+  __types = reinterpret_cast<const int32_t*>(__base + sizeof(Header));
+
+  // trust the index only if it lists every frame back to back, a new frame may
+  // have overwritten the beginning of it
+  auto trailer = reinterpret_cast<const Trailer*>(__base + __length - sizeof(Trailer));
+  if (std::memcmp(trailer->magic, kTrailerMagic, 8) == 0 &&
+      trailer->index_offset == first + trailer->frames*width &&
+      trailer->index_offset + trailer->frames*sizeof(uint64_t) + sizeof(Trailer) == __length) {
+    auto index = reinterpret_cast<const uint64_t*>(__base + trailer->index_offset);
+    uint64_t k = 0;
+    while (k < trailer->frames && index[k] == first + k*width)
+      k++;
+    if (k == trailer->frames) {
+      __index = index;
+      __frames = trailer->frames;
+      return;
+    }
+  }
+  // an append was interrupted, frames before it are complete
+  __recovered = scan_frames(first, width, __length, [this](uint64_t offset, char* magic) {
+    std::memcpy(magic, __base + offset, 8);
+    return true;
+  });
+  __index = __recovered.data();
+  __frames = __recovered.size();
+  __broken_index = true;
+}
+
+Reader::~Reader() {
+  if (__base != nullptr)
+    munmap(const_cast<char*>(__base), __length);
+}
+
+int64_t Reader::time_step(size_t k) const {
+  int64_t result;
+  std::memcpy(&result, __frame(k), sizeof(result));
+  return result;
+}
+
+const double* Reader::positions(size_t k) const {
+  return reinterpret_cast<const double*>(__frame(k) + sizeof(int64_t));
+}
+
+const double* Reader::velocities(size_t k) const {
+  if ((__header->flags & kHasVelocities) == 0)
+    return nullptr;
+  return positions(k) + 3*__header->atoms;
+}
+
+const double* Reader::column(size_t k, int column) const {
+  int vectors = ((__header->flags & kHasVelocities) != 0) ? 2 : 1;
+  return positions(k) + (3*vectors + column)*__header->atoms;
+}
+
+} // namespace UtilsTrajectory
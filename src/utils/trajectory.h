@@ -0,0 +1,133 @@
+/**
+ * @file trajectory.h
+ * @author Bohan Cao (2110313@mail.nankai.edu.cn)
+ * @brief Binary trajectory with frame index
+ * @version 0.0.1
+ * @date 2023-03-22
+ * 
+ * @copyright Copyright (c) 2023
+ */
+#ifndef QUADRATUBE_UTILS_TRAJECTORY_H_
+#define QUADRATUBE_UTILS_TRAJECTORY_H_
+
+#include <cstdint>
+
+#include <string>
+#include <vector>
+
+#include "core/math.h"
+
+namespace UtilsTrajectory {
+
+/**
+ * @brief Layout of binary trajectory, all little-endian
+ * @details
+ * 1. Header, then topology once: int32 types[atoms], int32 bonds1[bonds1][2],
+ *   int32 bonds2[bonds2][2].
+ * 2. Frames of fixed width, back to back from an 8-byte boundary: int64 time step,
+ *   double positions[atoms][3], double velocities[atoms][3] (if kHasVelocities),
+ *   double columns[columns][atoms], then kFrameMagic written last.
+ * 3. Index: uint64 offsets[frames] of every frame, then Trailer at the end of file.
+ *   Appending a frame overwrites the index and writes a new one after the frame.
+ *   If that is interrupted, complete frames are still found by their kFrameMagic.
+ */
+const char kHeaderMagic[8] = {'Q', 'T', 'U', 'B', 'E', 'T', 'R', 'J'};
+const char kFrameMagic[8] = {'Q', 'T', 'U', 'B', 'E', 'F', 'R', 'M'};
+const char kTrailerMagic[8] = {'Q', 'T', 'U', 'B', 'E', 'I', 'D', 'X'};
+const uint32_t kVersion = 2;
+const uint32_t kHasVelocities = 1 << 0;
+const int kMaxColumns = 8;
+
+struct Header {
+  char magic[8];
+  uint32_t version;
+  uint32_t flags;
+  uint64_t atoms;
+  uint64_t bonds1;
+  uint64_t bonds2;
+  uint32_t columns;
+  uint32_t reserved;
+  /// xlo xhi ylo yhi zlo zhi
+  double boundary[6];
+  /// mass of every atom type
+  double mass;
+  char column_names[kMaxColumns][16];
+};
+
+struct Trailer {
+  uint64_t index_offset;
+  uint64_t frames;
+  char magic[8];
+};
+
+/// @brief topology, written when a file is created
+struct Topology {
+  std::vector<int32_t> types;
+  std::vector<CoreMath::Pair<int>> bonds1;
+  std::vector<CoreMath::Pair<int>> bonds2;
+  double boundary[6];
+  std::vector<std::string> column_names;
+  double mass;
+};
+
+/**
+ * @brief append a frame, create the file with topology if time_step is 0 or file
+ *     doesn't exist
+ * 
+ * @param velocities NULL if not written
+ * @param columns column major, columns[k*atoms + i] is column k of atom i
+ * @return false if failed or layout of existing file is different
+ */
+bool append(const std::string& file_name, const Topology& topology, int64_t time_step,
+    size_t atoms, const CoreMath::Vector* positions, const CoreMath::Vector* velocities,
+    const double* columns);
+
+/**
+ * @class Reader
+ * @brief Memory mapped reader, seek any frame in O(1) by index
+ * @details Pointers point into the mapped file and are valid while reader lives.
+ *     Only little-endian hosts are supported.
+ */
+class Reader {
+  public:
+    Reader(const std::string& file_name);
+    ~Reader();
+    Reader(const Reader&) = delete;
+    Reader& operator=(const Reader&) = delete;
+
+    /// @brief whether file is a trajectory
+    inline bool good() const { return __header != nullptr; }
+    /// @brief whether the index was broken (an interrupted append) and frames were
+    ///     found by scanning instead
+    inline bool recovered() const { return __broken_index; }
+    inline const Header& header() const { return *__header; }
+    inline size_t frames() const { return __frames; }
+
+    /// @brief topology
+    inline const int32_t* types() const { return __types; }
+    inline const int32_t* bonds1() const { return __types + __header->atoms; }
+    inline const int32_t* bonds2() const { return bonds1() + 2*__header->bonds1; }
+
+    /// @brief data of frame k, velocities is NULL if not written
+    int64_t time_step(size_t k) const;
+    const double* positions(size_t k) const;
+    const double* velocities(size_t k) const;
+    const double* column(size_t k, int column) const;
+
+  private:
+    const char* __frame(size_t k) const { return __base + __index[k]; }
+
+    const char* __base = nullptr;
+    size_t __length = 0;
+    const Header* __header = nullptr;
+    const int32_t* __types = nullptr;
+    const uint64_t* __index = nullptr;
+    size_t __frames = 0;
+    /// @brief index found by scanning, if the one in file is broken
+    std::vector<uint64_t> __recovered;
+    bool __broken_index = false;
+};
+
+} // namespace UtilsTrajectory
+
+#endif // QUADRATUBE_UTILS_TRAJECTORY_H_
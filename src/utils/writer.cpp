@@ -0,0 +1,88 @@
+/**
+ * @file writer.cpp
+ * @author Bohan Cao (2110313@mail.nankai.edu.cn)
+ * @brief Asynchronous writer of dump frames
+ * @version 0.0.1
+ * @date 2023-03-21
+ * 
+ * @copyright Copyright (c) 2023
+ */
+#include "utils/writer.h"
+
+#include <stdio.h>
+
+namespace UtilsWriter {
+
+AsyncWriter::AsyncWriter(Sink sink): __sink(sink) {
+  __worker = std::thread(&AsyncWriter::__run, this);
+}
+
+AsyncWriter::~AsyncWriter() {
+  {
+    std::lock_guard<std::mutex> lock(__mutex);
+    __stop = true;
+  }
+  __condition.notify_all();
+  __worker.join();
+  report();
+}
+
+Frame& AsyncWriter::acquire() {
+  double begin = __timer.seconds();
+  std::unique_lock<std::mutex> lock(__mutex);
+  __condition.wait(lock, [this] { return __busy < 2; });
+  __stall_time += __timer.seconds() - begin;
+  return __frames[__fill];
+}
+
+void AsyncWriter::submit(double copy_time) {
+  {
+    std::lock_guard<std::mutex> lock(__mutex);
+    __frames[__fill].submit_time = __timer.seconds();
+    __copy_time += copy_time;
+    __fill = 1 - __fill;
+    __busy++;
+  }
+  __condition.notify_all();
+}
+
+void AsyncWriter::flush() {
+  std::unique_lock<std::mutex> lock(__mutex);
+  __condition.wait(lock, [this] { return __busy == 0; });
+}
+
+void AsyncWriter::report() {
+  std::lock_guard<std::mutex> lock(__mutex);
+  if (__frame_count == 0)
+    return;
+  std::printf("dump writer: %i frames, copy %.3fms/frame, lag %.3fms/frame (max %.3fms), "
+      "stalled %.3fms\n", __frame_count, __copy_time/__frame_count*1000,
+      __lag_time/__frame_count*1000, __max_lag_time*1000, __stall_time*1000);
+}
+
+void AsyncWriter::__run() {
+  std::unique_lock<std::mutex> lock(__mutex);
+  while (true) {
+    __condition.wait(lock, [this] { return __busy > 0 || __stop; });
+    // remaining frames are still written when stopped
+    if (__busy == 0)
+      return;
+
+    // buffer won't be touched by caller until __busy decreases
+    Frame& frame = __frames[__write];
+    lock.unlock();
+    __sink(frame);
+    frame.context.reset();
+    lock.lock();
+
+    double lag = __timer.seconds() - frame.submit_time;
+    __lag_time += lag;
+    __max_lag_time = (lag > __max_lag_time) ? lag : __max_lag_time;
+    __frame_count++;
+    __write = 1 - __write;
+    __busy--;
+    __condition.notify_all();
+  }
+}
+
+} // namespace UtilsWriter
@@ -0,0 +1,103 @@
+/**
+ * @file writer.h
+ * @author Bohan Cao (2110313@mail.nankai.edu.cn)
+ * @brief Asynchronous writer of dump frames
+ * @version 0.0.1
+ * @date 2023-03-21
+ * 
+ * @copyright Copyright (c) 2023
+ */
+#ifndef QUADRATUBE_UTILS_WRITER_H_
+#define QUADRATUBE_UTILS_WRITER_H_
+
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include <Kokkos_Core.hpp>
+
+#include "metadata.h"
+#include "core/math.h"
+
+namespace UtilsWriter {
+
+/// @brief page-locked host memory when device is a gpu, for fast copy
+#ifdef KOKKOS_ENABLE_CUDA
+using PinnedSpace = Kokkos::CudaHostPinnedSpace;
+#else
+using PinnedSpace = Kokkos::HostSpace;
+#endif
+
+/**
+ * @brief Snapshot of a system for one dump
+ * 
+ */
+struct Frame {
+  /// @brief n x 3 in the same layout as system, so that copies are contiguous
+  using View = Kokkos::View<double*[3], CoreMath::NodeLayout, PinnedSpace>;
+  using ColumnView = Kokkos::View<double*, PinnedSpace>;
+
+  std::string file_name;
+  int time_step;
+  Metadata::DumpType dump_type;
+  size_t size;
+  View positions;
+  View velocities;
+  /// @brief custom columns, column major
+  ColumnView columns;
+  /// @brief when it is handed to writer, for statistics
+  double submit_time;
+  /// @brief whatever sink needs besides the frame, taken at the same time as it so
+  ///     that they always match. Opaque to writer
+  std::shared_ptr<const void> context;
+};
+
+/**
+ * @brief Double buffered writer with a background thread
+ * @details The caller fills a free buffer (acquire), hands it over (submit) and
+ *     continues immediately. Frames are written in submit order. If both buffers
+ *     are still being written, acquire blocks until one is free (back-pressure).
+ */
+class AsyncWriter {
+  public:
+    /// @brief sink formats and writes a frame, called on writer thread
+    using Sink = std::function<void(const Frame&)>;
+
+    AsyncWriter(Sink sink);
+    /// @brief write remaining frames and print statistics
+    ~AsyncWriter();
+
+    /// @brief free buffer to be filled, wait if there isn't any
+    Frame& acquire();
+    /// @brief hand the acquired buffer to writer, copy_time is cost of filling it
+    void submit(double copy_time);
+    /// @brief wait until every submitted frame is written
+    void flush();
+    /// @brief print frames, copy cost, writer lag and stall time
+    void report();
+
+  private:
+    void __run();
+
+    Sink __sink;
+    Frame __frames[2];
+    /// @brief next buffer to fill, next buffer to write, buffers waiting or writing
+    int __fill = 0, __write = 0, __busy = 0;
+    bool __stop = false;
+
+    std::mutex __mutex;
+    std::condition_variable __condition;
+    std::thread __worker;
+
+    /// @brief statistics, in seconds
+    Kokkos::Timer __timer;
+    int __frame_count = 0;
+    double __copy_time = 0, __lag_time = 0, __max_lag_time = 0, __stall_time = 0;
+};
+
+} // namespace UtilsWriter
+
+#endif // QUADRATUBE_UTILS_WRITER_H_